@@ -1,45 +1,64 @@
 #include "API.hpp"
 
+#include "BufferManager.hpp"
 #include "CatalogManager.hpp"
 #include "DataStructure.hpp"
 #include "IndexManager.hpp"
 #include "Interpreter.hpp"
 #include "RecordManager.hpp"
 
+/**
+ * @brief make sure that the database can be modified
+ */
+static void CheckWritable() {
+  if (BufferManager::ReadOnly())
+    throw read_only_error("the database is opened read-only");
+}
+
 bool CreateTable(
     const string &table_name,
-    const vector<tuple<string, SqlValueType, SpecialAttribute>> &attributes) {
-  catalog_manager.CreateTable(table_name, attributes);
-  if (!record_manager.createTable(catalog_manager.TableInfo(table_name)))
-    return false;
-  if (!index_manager.PrimaryKeyIndex(catalog_manager.TableInfo(table_name)))
-    return false;
-  return true;
+    const vector<tuple<string, SqlValueType, SpecialAttribute>> &attributes,
+    const TableLayout &layout) {
+  CheckWritable();
+  catalog_manager.CreateTable(table_name, attributes, layout);
+  const bool created =
+      record_manager.createTable(catalog_manager.TableInfo(table_name)) &&
+      index_manager.PrimaryKeyIndex(catalog_manager.TableInfo(table_name));
+  BufferManager::Commit();
+  return created;
 }
 
 bool DropTable(const string &table_name) {
+  CheckWritable();
   if (!record_manager.dropTable(catalog_manager.TableInfo(table_name)))
     return false;
   index_manager.DropAllIndex(catalog_manager.TableInfo(table_name));
   catalog_manager.DropTable(table_name);
+  buffer_manager.Truncate();
+  BufferManager::Commit();
   return true;
 }
 
 bool CreateIndex(const string &table_name, const string &index_name,
                  const string &column) {
+  CheckWritable();
   catalog_manager.CreateIndex(table_name, column, index_name);
-  if (!index_manager.CreateIndex(catalog_manager.TableInfo(table_name),
-                                 index_name, column))
-    return false;
-  return true;
+  const bool created = index_manager.CreateIndex(
+      catalog_manager.TableInfo(table_name), index_name, column);
+  BufferManager::Commit();
+  return created;
 }
 
 bool DropIndex(const string &table_name, const string &index_name) {
+  CheckWritable();
+  // the index manager needs the attribute of the index, which the catalog
+  // forgets
+  const Table table = catalog_manager.TableInfo(table_name);
   catalog_manager.DropIndex(table_name, index_name);
-  if (!index_manager.DropIndex(catalog_manager.TableInfo(table_name),
-                               index_name))
-    return false;
-  return true;
+  const bool dropped = index_manager.DropIndex(table, index_name);
+  if (dropped) buffer_manager.Truncate();
+  BufferManager::Commit();
+  return dropped;
 }
 
 vector<Tuple> Select(const string &table_name,
@@ -59,25 +78,56 @@ vector<Tuple> Select(const string &table_name,
 }
 
 size_t Insert(const string &table_name, const Tuple &tuple) {
+  CheckWritable();
   Position pos =
       record_manager.insertRecord(catalog_manager.TableInfo(table_name), tuple);
   index_manager.InsertKey(catalog_manager.TableInfo(table_name), tuple, pos);
+  BufferManager::Commit();
   return 1;
 }
 
 size_t InsertFast(const Table &table, const Tuple &tp,
                   const vector<tuple<const char *, size_t, size_t>> &unique) {
+  CheckWritable();
+  for (const auto &[attribute, index_name] : table.indexes) {
+    const auto &[idx, type, special, offset] = table.attributes.at(attribute);
+    if (special >= SpecialAttribute::PrimaryKey &&
+        index_manager.Contains(table, index_name, tp.values[idx])) {
+      cerr << "the record is not unique" << endl;
+      throw invalid_value("record duplicate");
+    }
+  }
   Position pos = record_manager.insertRecordUnique(table, tp, unique);
   index_manager.InsertKey(table, tp, pos);
+  BufferManager::Commit();
   return 1;
 }
 
 size_t Delete(const string &table_name, const vector<Condition> &conditions) {
+  CheckWritable();
   size_t n;
+  const Table &table = catalog_manager.TableInfo(table_name);
+  const auto remove_key = [&table](const Tuple &tuple, const Position &pos) {
+    index_manager.RemoveKey(table, tuple, pos);
+  };
   if (conditions.empty())
-    n = record_manager.deleteAllRecords(catalog_manager.TableInfo(table_name));
+    n = record_manager.deleteAllRecords(table, remove_key);
   else
-    n = record_manager.deleteRecord(catalog_manager.TableInfo(table_name),
-                                    conditions);
+    n = record_manager.deleteRecord(table, conditions, remove_key);
+  BufferManager::Commit();
   return n;
 }
+
+VacuumStats Vacuum(const string &table_name) {
+  CheckWritable();
+  const Table &table = catalog_manager.TableInfo(table_name);
+  const auto stats = record_manager.vacuumTable(
+      table, [&table](const Tuple &tuple, const Position &from,
+                      const Position &to) {
+        index_manager.RemoveKey(table, tuple, from);
+        index_manager.InsertKey(table, tuple, to);
+      });
+  if (stats.released) buffer_manager.Truncate();
+  BufferManager::Commit();
+  return stats;
+}
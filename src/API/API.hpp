@@ -13,11 +13,13 @@ using std::vector;
  *
  * @param table_name the name of the table
  * @param attributes the attributes of the table
+ * @param layout how the records are stored
  * @return true if successful
  */
 bool CreateTable(
     const string &table_name,
-    const vector<tuple<string, SqlValueType, SpecialAttribute>> &attributes);
+    const vector<tuple<string, SqlValueType, SpecialAttribute>> &attributes,
+    const TableLayout &layout = TableLayout::Row);
 
 /**
  * @brief Drop a table
@@ -63,6 +65,15 @@ vector<Tuple> Select(const string &table_name,
  */
 size_t Insert(const string &table_name, const Tuple &tuple);
 
+/**
+ * @brief Insert a record into a table, the unique attributes with an index are
+ * checked through the index
+ *
+ * @param table the table
+ * @param tp the record
+ * @param unique the value, size and index in the record of each unique
+ * attribute without an index, they are checked by scanning the table
+ */
 size_t InsertFast(const Table &table, const Tuple &tp,
                   const vector<tuple<const char *, size_t, size_t>> &unique);
 
@@ -74,3 +85,12 @@ size_t InsertFast(const Table &table, const Tuple &tp,
  * records.
  */
 size_t Delete(const string &table_name, const vector<Condition> &conditions);
+
+/**
+ * @brief Compact a table: move its records out of its last blocks into the
+ * free slots of the others, and release the emptied blocks
+ *
+ * @param table_name the name of the table
+ * @return the numbers of moved records and released blocks
+ */
+VacuumStats Vacuum(const string &table_name);
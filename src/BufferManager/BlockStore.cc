@@ -0,0 +1,459 @@
+#include "BlockStore.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include "Page.hpp"
+
+static void ThrowErrno(const string &what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+size_t BlockStore::WriteBatch(const std::vector<size_t> &block_ids,
+                              const std::vector<const char *> &bufs) {
+  size_t runs = 0;
+  std::vector<const char *> run;
+  for (size_t i = 0, j; i < block_ids.size(); i = j, runs++) {
+    j = i + 1;
+    while (j < block_ids.size() && j - i < Config::kMaxWriteRun &&
+           block_ids[j] == block_ids[j - 1] + 1)
+      j++;
+    run.assign(bufs.begin() + i, bufs.begin() + j);
+    WriteRun(block_ids[i], run);
+  }
+  return runs;
+}
+
+void FileBlockStore::Read(const size_t &block_id, char *buf) {
+  std::ifstream is(Block::GetBlockFilename(block_id), std::ios::binary);
+  is.read(buf, Config::kPageSize);
+  memset(buf + is.gcount(), 0, Config::kPageSize - is.gcount());
+}
+
+void FileBlockStore::Write(const size_t &block_id, const char *buf) {
+  std::ofstream os(Block::GetBlockFilename(block_id), std::ios::binary);
+  os.write(buf, Config::kPageSize);
+}
+
+size_t FileBlockStore::Size() {
+  size_t l = std::numeric_limits<size_t>::min(),
+         r = std::numeric_limits<size_t>::max();
+  while (l != r) {
+    auto m = (l + r) >> 1;
+    if (std::filesystem::exists(Block::GetBlockFilename(m)))
+      l = m + 1;
+    else
+      r = m;
+  }
+  return l;
+}
+
+void FileBlockStore::Discard(const size_t &block_id) {
+  // keep the empty file, Size() assumes that there are no holes
+  std::error_code ec;
+  std::filesystem::resize_file(Block::GetBlockFilename(block_id), 0, ec);
+}
+
+void FileBlockStore::Truncate(const size_t &block_count) {
+  for (auto block_id = block_count;
+       std::filesystem::remove(Block::GetBlockFilename(block_id)); block_id++)
+    ;
+}
+
+void FileBlockStore::Sync() {
+  const int fd = open(CommonPathPrefix, O_RDONLY | O_DIRECTORY);
+  if (fd < 0) ThrowErrno("can't open " CommonPathPrefix);
+  if (syncfs(fd) < 0) {
+    const auto error = errno;
+    close(fd);
+    errno = error;
+    ThrowErrno("can't sync " CommonPathPrefix);
+  }
+  close(fd);
+}
+
+void FileBlockStore::Remove() {
+  std::vector<std::filesystem::path> block_files;
+  std::error_code ec;
+  for (const auto &entry :
+       std::filesystem::directory_iterator(CommonPathPrefix, ec))
+    if (entry.path().extension() == ".block")
+      block_files.push_back(entry.path());
+  for (const auto &path : block_files) std::filesystem::remove(path);
+}
+
+TablespaceBlockStore::~TablespaceBlockStore() {
+  for (const auto &fd : fds_)
+    if (fd >= 0) close(fd);
+}
+
+int TablespaceBlockStore::Fd(const size_t &file_no, bool create) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_no >= fds_.size()) {
+    fds_.resize(file_no + 1, -1);
+    allocated_.resize(file_no + 1, 0);
+  }
+  if (fds_[file_no] < 0) {
+    const auto filename = GetDataFilename(file_no);
+    const int flags = create ? O_RDWR | O_CREAT : O_RDWR;
+#ifdef DirectIO
+    fds_[file_no] = open(filename.c_str(), flags | O_DIRECT, 0644);
+    if (fds_[file_no] < 0 && errno == EINVAL) {  // e.g. tmpfs
+      std::cerr << "O_DIRECT isn't supported for " << filename << std::endl;
+      fds_[file_no] = open(filename.c_str(), flags, 0644);
+    }
+#else
+    fds_[file_no] = open(filename.c_str(), flags, 0644);
+#endif
+    if (fds_[file_no] < 0 && (create || errno != ENOENT))
+      ThrowErrno("can't open " + filename);
+  }
+  return fds_[file_no];
+}
+
+void TablespaceBlockStore::Read(const size_t &block_id, char *buf) {
+  const auto fd = Fd(block_id / Config::kBlocksPerDataFile, false);
+  ssize_t done = 0;
+  if (fd >= 0) {
+    const off_t offset =
+        (block_id % Config::kBlocksPerDataFile) * Config::kPageSize;
+    while (done < Config::kPageSize) {
+      auto ret = pread(fd, buf + done, Config::kPageSize - done,
+                       offset + done);
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret < 0) ThrowErrno("can't read block " + std::to_string(block_id));
+      if (ret == 0) break;  // beyond the end of the file
+      done += ret;
+    }
+  }
+  memset(buf + done, 0, Config::kPageSize - done);
+}
+
+void TablespaceBlockStore::Reserve(const size_t &file_no, const int &fd,
+                                   const size_t &block_no) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (block_no < allocated_[file_no]) return;
+  // reserve the space without changing the size of the file, so that the
+  // size still tells how many blocks have been written
+  auto extent =
+      (block_no / Config::kDataFileExtent + 1) * Config::kDataFileExtent;
+  if (extent > Config::kBlocksPerDataFile) extent = Config::kBlocksPerDataFile;
+  fallocate(fd, FALLOC_FL_KEEP_SIZE, 0,
+            static_cast<off_t>(extent) * Config::kPageSize);
+  allocated_[file_no] = extent;
+}
+
+void TablespaceBlockStore::Write(const size_t &block_id, const char *buf) {
+  const auto file_no = block_id / Config::kBlocksPerDataFile;
+  const auto fd = Fd(file_no, true);
+  const auto block_no = block_id % Config::kBlocksPerDataFile;
+  Reserve(file_no, fd, block_no);
+  const off_t offset = block_no * Config::kPageSize;
+  ssize_t done = 0;
+  while (done < Config::kPageSize) {
+    auto ret =
+        pwrite(fd, buf + done, Config::kPageSize - done, offset + done);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0) ThrowErrno("can't write block " + std::to_string(block_id));
+    done += ret;
+  }
+}
+
+void TablespaceBlockStore::WriteRun(const size_t &first_id,
+                                    const std::vector<const char *> &bufs) {
+  std::vector<iovec> iov;
+  for (size_t i = 0; i < bufs.size();) {
+    // a single pwritev can't cross a data file or take more than IOV_MAX
+    const auto file_no = (first_id + i) / Config::kBlocksPerDataFile;
+    const auto block_no = (first_id + i) % Config::kBlocksPerDataFile;
+    const auto count = std::min({bufs.size() - i,
+                                 Config::kBlocksPerDataFile - block_no,
+                                 static_cast<size_t>(IOV_MAX)});
+    const auto fd = Fd(file_no, true);
+    Reserve(file_no, fd, block_no + count - 1);
+    iov.resize(count);
+    for (size_t j = 0; j < count; j++)
+      iov[j] = {const_cast<char *>(bufs[i + j]), Config::kPageSize};
+    off_t offset = block_no * Config::kPageSize;
+    for (size_t k = 0; k < count;) {
+      auto ret = pwritev(fd, iov.data() + k, count - k, offset);
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret < 0)
+        ThrowErrno("can't write block " + std::to_string(first_id + i + k));
+      offset += ret;
+      for (; k < count && static_cast<size_t>(ret) >= iov[k].iov_len; k++)
+        ret -= iov[k].iov_len;
+      if (ret > 0) {  // a partial write ends in the middle of a block
+        iov[k].iov_base = static_cast<char *>(iov[k].iov_base) + ret;
+        iov[k].iov_len -= ret;
+      }
+    }
+    i += count;
+  }
+}
+
+size_t TablespaceBlockStore::Size() {
+  size_t file_no = 0;
+  while (std::filesystem::exists(GetDataFilename(file_no + 1))) file_no++;
+  const auto fd = Fd(file_no, false);
+  if (fd < 0) return 0;
+  struct stat st;
+  if (fstat(fd, &st) < 0) ThrowErrno("can't stat " + GetDataFilename(file_no));
+  return file_no * Config::kBlocksPerDataFile +
+         (st.st_size + Config::kPageSize - 1) / Config::kPageSize;
+}
+
+void TablespaceBlockStore::Discard(const size_t &block_id) {
+  const auto fd = Fd(block_id / Config::kBlocksPerDataFile, false);
+  if (fd < 0) return;
+  const off_t offset =
+      (block_id % Config::kBlocksPerDataFile) * Config::kPageSize;
+  fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+            Config::kPageSize);
+}
+
+void TablespaceBlockStore::Truncate(const size_t &block_count) {
+  const auto file_no = block_count / Config::kBlocksPerDataFile;
+  for (auto i = file_no + 1;
+       std::filesystem::remove(GetDataFilename(i)); i++) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (i < fds_.size() && fds_[i] >= 0) {
+      close(fds_[i]);
+      fds_[i] = -1;
+      allocated_[i] = 0;
+    }
+  }
+  const auto fd = Fd(file_no, false);
+  if (fd < 0) return;
+  const auto block_no = block_count % Config::kBlocksPerDataFile;
+  // the preallocated space beyond the new end is released as well
+  if (ftruncate(fd, static_cast<off_t>(block_no) * Config::kPageSize) < 0)
+    ThrowErrno("can't truncate " + GetDataFilename(file_no));
+  std::lock_guard<std::mutex> lock(mutex_);
+  allocated_[file_no] = block_no;
+}
+
+void TablespaceBlockStore::Sync() {
+  // the reads and writes take the lock for their descriptors, so the files
+  // are synced without it, through duplicates which stay valid if Truncate
+  // closes a file meanwhile
+  std::vector<std::pair<size_t, int>> fds;
+  int error = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < fds_.size() && !error; i++) {
+      if (fds_[i] < 0) continue;
+      const auto fd = dup(fds_[i]);
+      if (fd < 0)
+        error = errno;
+      else
+        fds.emplace_back(i, fd);
+    }
+  }
+  string what = "can't duplicate a data file";
+  for (const auto &[file_no, fd] : fds) {
+    if (!error && fdatasync(fd) < 0) {
+      error = errno;
+      what = "can't sync " + GetDataFilename(file_no);
+    }
+    close(fd);
+  }
+  if (error) {
+    errno = error;
+    ThrowErrno(what);
+  }
+}
+
+#ifdef IoUring
+UringBlockStore::UringBlockStore() {
+  try {
+    uring_ = std::make_unique<Uring>(Config::kUringEntries);
+  } catch (const std::system_error &e) {
+    std::cerr << "io_uring is unavailable, using pread/pwrite: " << e.what()
+              << std::endl;
+  }
+}
+
+void UringBlockStore::RegisterBuffer(const char *base, const size_t &size) {
+  if (uring_ && !uring_->Register(base, size))
+    std::cerr << "Failed to register the buffer to io_uring" << std::endl;
+}
+
+void UringBlockStore::ReadBatch(const std::vector<size_t> &block_ids,
+                                const std::vector<char *> &bufs) {
+  if (!uring_) return TablespaceBlockStore::ReadBatch(block_ids, bufs);
+  std::vector<UringRequest> requests;
+  std::vector<size_t> indexes;  // of the block of each request
+  for (size_t i = 0; i < block_ids.size(); i++) {
+    const auto fd = Fd(block_ids[i] / Config::kBlocksPerDataFile, false);
+    if (fd < 0) {  // never written
+      memset(bufs[i], 0, Config::kPageSize);
+      continue;
+    }
+    const off_t offset =
+        (block_ids[i] % Config::kBlocksPerDataFile) * Config::kPageSize;
+    requests.push_back({false, fd, offset, {{bufs[i], Config::kPageSize}}, 0});
+    indexes.push_back(i);
+  }
+  uring_->Submit(requests);
+  // a short read reaches the end of the file, and an error may be transient,
+  // pread sorts them out
+  for (size_t k = 0; k < requests.size(); k++)
+    if (requests[k].result != Config::kPageSize)
+      Read(block_ids[indexes[k]], bufs[indexes[k]]);
+}
+
+size_t UringBlockStore::WriteBatch(const std::vector<size_t> &block_ids,
+                                   const std::vector<const char *> &bufs) {
+  if (!uring_) return TablespaceBlockStore::WriteBatch(block_ids, bufs);
+  std::vector<UringRequest> requests;
+  std::vector<std::pair<size_t, size_t>> runs;  // [first, last) of requests
+  for (size_t i = 0, j; i < block_ids.size(); i = j) {
+    // a run can't cross a data file or take more than IOV_MAX
+    const auto file_no = block_ids[i] / Config::kBlocksPerDataFile;
+    const auto block_no = block_ids[i] % Config::kBlocksPerDataFile;
+    const auto max_run = std::min({Config::kMaxWriteRun,
+                                   Config::kBlocksPerDataFile - block_no,
+                                   static_cast<size_t>(IOV_MAX)});
+    j = i + 1;
+    while (j < block_ids.size() && j - i < max_run &&
+           block_ids[j] == block_ids[j - 1] + 1)
+      j++;
+    const auto fd = Fd(file_no, true);
+    Reserve(file_no, fd, block_no + (j - i) - 1);
+    UringRequest request = {true, fd,
+                            static_cast<off_t>(block_no * Config::kPageSize),
+                            {}, 0};
+    for (auto k = i; k < j; k++)
+      request.iov.push_back({const_cast<char *>(bufs[k]), Config::kPageSize});
+    requests.push_back(std::move(request));
+    runs.emplace_back(i, j);
+  }
+  uring_->Submit(requests);
+  // pwritev finishes a short write, or reports the error
+  for (size_t k = 0; k < requests.size(); k++) {
+    const auto &[first, last] = runs[k];
+    if (requests[k].result !=
+        static_cast<ssize_t>((last - first) * Config::kPageSize))
+      WriteRun(block_ids[first], std::vector<const char *>(
+                                     bufs.begin() + first, bufs.begin() + last));
+  }
+  return requests.size();
+}
+#endif
+
+TablespaceMapping::TablespaceMapping(const size_t &block_count)
+    : block_count_(block_count),
+      blocks_(std::make_unique<Block[]>(block_count)),
+      verified_(std::make_unique<std::atomic<bool>[]>(block_count)) {
+  auto zeros = mmap(nullptr, Config::kPageSize, PROT_READ,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (zeros == MAP_FAILED) ThrowErrno("mmap");
+  zeros_ = static_cast<char *>(zeros);
+  const auto file_num = (block_count + Config::kBlocksPerDataFile - 1) /
+                        Config::kBlocksPerDataFile;
+  for (size_t file_no = 0; file_no < file_num; file_no++) {
+    const auto filename = TablespaceBlockStore::GetDataFilename(file_no);
+    const auto fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0 && errno == ENOENT) {  // never written
+      files_.push_back({nullptr, 0});
+      continue;
+    }
+    if (fd < 0) {
+      Unmap();
+      ThrowErrno("can't open " + filename);
+    }
+    struct stat st;
+    void *base = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+      base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    const auto error = errno;
+    close(fd);  // the mapping stays
+    if (base == MAP_FAILED) {
+      Unmap();
+      throw std::system_error(error, std::generic_category(),
+                              "can't map " + filename);
+    }
+    files_.push_back({static_cast<char *>(base),
+                      base ? static_cast<size_t>(st.st_size) : 0});
+  }
+  for (size_t block_id = 0; block_id < block_count; block_id++) {
+    const auto &file = files_[block_id / Config::kBlocksPerDataFile];
+    const auto offset =
+        (block_id % Config::kBlocksPerDataFile) * Config::kPageSize;
+    blocks_[block_id].page_ =
+        offset + Config::kPageSize <= file.size ? file.base + offset : zeros_;
+    blocks_[block_id].val_ =
+        blocks_[block_id].page_ + Config::kPageHeaderSize;
+  }
+}
+
+TablespaceMapping::~TablespaceMapping() { Unmap(); }
+
+void TablespaceMapping::Unmap() {
+  for (const auto &file : files_)
+    if (file.base) munmap(file.base, file.size);
+  files_.clear();
+  munmap(zeros_, Config::kPageSize);
+}
+
+Block *TablespaceMapping::Get(const size_t &block_id) {
+  if (block_id >= block_count_)
+    throw std::out_of_range("block_id out of range");
+  if (!verified_[block_id].load(std::memory_order_acquire)) {
+    if (!VerifyPage(blocks_[block_id].page_))
+      throw CorruptPage(block_id);
+    verified_[block_id].store(true, std::memory_order_release);
+  }
+  return &blocks_[block_id];
+}
+
+void TablespaceMapping::WillNeed(const size_t &block_id) {
+  if (block_id < block_count_ && blocks_[block_id].page_ != zeros_)
+    madvise(blocks_[block_id].page_, Config::kPageSize, MADV_WILLNEED);
+}
+
+size_t MigrateBlockFiles() {
+  FileBlockStore src;
+  TablespaceBlockStore dst;
+  alignas(Config::kDirectIOAlignment) char buf[Config::kPageSize];
+  alignas(Config::kDirectIOAlignment) char page[Config::kPageSize];
+  size_t count = 0;
+  std::error_code ec;
+  for (const auto &entry :
+       std::filesystem::directory_iterator(CommonPathPrefix, ec)) {
+    if (entry.path().extension() != ".block") continue;
+    const auto block_id = std::stoull(entry.path().stem().string());
+    src.Read(block_id, buf);
+    if (!VerifyPage(buf)) {
+      // a block written before the pages had headers, the header takes the
+      // place of its last bytes, which should be unused
+      if (std::any_of(buf + Config::kBlockSize, buf + Config::kPageSize,
+                      [](const char &byte) { return byte != 0; }))
+        throw std::runtime_error("block " + std::to_string(block_id) +
+                                 " doesn't fit in a page");
+      InitPage(page, PageType::Other);
+      memcpy(page + Config::kPageHeaderSize, buf, Config::kBlockSize);
+      SealPage(page, 0);
+      memcpy(buf, page, Config::kPageSize);
+    }
+    dst.Write(block_id, buf);
+    count++;
+  }
+  dst.Sync();
+  return count;
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "DataStructure.hpp"
+#ifdef IoUring
+#include "Uring.hpp"
+#endif
+
+/**
+ * @brief where the blocks live on the disk
+ */
+class BlockStore {
+ public:
+  virtual ~BlockStore() = default;
+
+  /**
+   * @brief read a block, the part that has never been written reads as zeros
+   *
+   * @param block_id the id of the block
+   * @param buf a buffer of Config::kPageSize bytes
+   */
+  virtual void Read(const size_t &block_id, char *buf) = 0;
+
+  /**
+   * @brief write a block
+   *
+   * @param block_id the id of the block
+   * @param buf a buffer of Config::kPageSize bytes
+   */
+  virtual void Write(const size_t &block_id, const char *buf) = 0;
+
+  /**
+   * @brief write a run of blocks with consecutive ids
+   *
+   * @param first_id the id of the first block
+   * @param bufs the buffers of Config::kPageSize bytes, one for each block
+   */
+  virtual void WriteRun(const size_t &first_id,
+                        const std::vector<const char *> &bufs) {
+    for (size_t i = 0; i < bufs.size(); i++) Write(first_id + i, bufs[i]);
+  }
+
+  /**
+   * @brief read some blocks
+   *
+   * @param block_ids the ids of the blocks
+   * @param bufs the buffers of Config::kPageSize bytes, one for each block
+   */
+  virtual void ReadBatch(const std::vector<size_t> &block_ids,
+                         const std::vector<char *> &bufs) {
+    for (size_t i = 0; i < block_ids.size(); i++) Read(block_ids[i], bufs[i]);
+  }
+
+  /**
+   * @brief write some blocks, the consecutive ids are written as runs of at
+   * most Config::kMaxWriteRun blocks
+   *
+   * @param block_ids the ids of the blocks in ascending order
+   * @param bufs the buffers of Config::kPageSize bytes, one for each block
+   * @return the number of runs written
+   */
+  virtual size_t WriteBatch(const std::vector<size_t> &block_ids,
+                            const std::vector<const char *> &bufs);
+
+  /**
+   * @brief tell the store where the buffers passed later come from
+   *
+   * @param base the beginning of the memory
+   * @param size the size of the memory
+   */
+  virtual void RegisterBuffer(const char * /* base */,
+                              const size_t & /* size */) {}
+
+  /**
+   * @brief get the number of blocks, i.e. one past the largest written id
+   *
+   * @return the number of blocks
+   */
+  virtual size_t Size() = 0;
+
+  /**
+   * @brief release the disk space of a freed block, it reads as zeros later
+   *
+   * @param block_id the id of the block
+   */
+  virtual void Discard(const size_t &block_id) = 0;
+
+  /**
+   * @brief remove the blocks whose ids are not less than block_count
+   *
+   * @param block_count the new number of blocks
+   */
+  virtual void Truncate(const size_t &block_count) = 0;
+
+  /**
+   * @brief flush the written blocks to the disk
+   */
+  virtual void Sync() {}
+};
+
+/**
+ * @brief one file per block: `.MiniSQL/<block_id>.block`
+ */
+class FileBlockStore : public BlockStore {
+ public:
+  void Read(const size_t &block_id, char *buf) override;
+  void Write(const size_t &block_id, const char *buf) override;
+  size_t Size() override;
+  void Discard(const size_t &block_id) override;
+  void Truncate(const size_t &block_count) override;
+
+  /**
+   * @brief flush the file system of the block files, which is cheaper than
+   * opening each of them again
+   */
+  void Sync() override;
+
+  /**
+   * @brief remove every block file
+   */
+  void Remove();
+};
+
+/**
+ * @brief blocks are stored at `block_id * Config::kPageSize` in a few data
+ * files (`.MiniSQL/Tablespace.<n>.data`) which are preallocated by extents
+ * and accessed by pread/pwrite through cached descriptors
+ */
+class TablespaceBlockStore : public BlockStore {
+  std::mutex mutex_;  // protects the two vectors below
+  std::vector<int> fds_;
+  std::vector<size_t> allocated_;  // preallocated blocks of each data file
+
+ protected:
+  /**
+   * @brief get the descriptor of a data file, open it if needed
+   *
+   * @param file_no the number of the data file
+   * @param create whether to create the file if it doesn't exist
+   * @return the descriptor, -1 if the file doesn't exist
+   */
+  int Fd(const size_t &file_no, bool create);
+
+  /**
+   * @brief make sure the space of a data file is preallocated up to a block
+   *
+   * @param file_no the number of the data file
+   * @param fd the descriptor of the data file
+   * @param block_no the number of the block in the data file
+   */
+  void Reserve(const size_t &file_no, const int &fd, const size_t &block_no);
+
+ public:
+  ~TablespaceBlockStore() override;
+  void Read(const size_t &block_id, char *buf) override;
+  void Write(const size_t &block_id, const char *buf) override;
+  void WriteRun(const size_t &first_id,
+                const std::vector<const char *> &bufs) override;
+  size_t Size() override;
+  void Discard(const size_t &block_id) override;
+  void Truncate(const size_t &block_count) override;
+  void Sync() override;
+
+  static string GetDataFilename(size_t file_no) {
+    return Config::kTablespaceFilePrefix + std::to_string(file_no) + ".data";
+  }
+};
+
+#ifdef IoUring
+/**
+ * @brief the tablespace whose batched reads and writes are submitted to an
+ * io_uring together, the single reads and writes still use pread/pwrite, and
+ * so does everything if io_uring isn't available
+ */
+class UringBlockStore : public TablespaceBlockStore {
+  std::unique_ptr<Uring> uring_;
+
+ public:
+  UringBlockStore();
+  void ReadBatch(const std::vector<size_t> &block_ids,
+                 const std::vector<char *> &bufs) override;
+  size_t WriteBatch(const std::vector<size_t> &block_ids,
+                    const std::vector<const char *> &bufs) override;
+  void RegisterBuffer(const char *base, const size_t &size) override;
+};
+#endif
+
+/**
+ * @brief the data files of the tablespace mapped read-only, a block is handed
+ * out as a descriptor pointing into the mapping instead of being copied (the
+ * blocks beyond the end of a data file point to a page of zeros)
+ */
+class TablespaceMapping {
+  struct DataFile {
+    char *base;
+    size_t size;  // in bytes
+  };
+  std::vector<DataFile> files_;
+  char *zeros_;
+  size_t block_count_;
+  std::unique_ptr<Block[]> blocks_;
+  // the pages are verified when they are first read
+  std::unique_ptr<std::atomic<bool>[]> verified_;
+
+  void Unmap();
+
+ public:
+  /**
+   * @brief map the data files
+   *
+   * @param block_count the number of blocks
+   */
+  explicit TablespaceMapping(const size_t &block_count);
+  ~TablespaceMapping();
+  TablespaceMapping(const TablespaceMapping &) = delete;
+  TablespaceMapping &operator=(const TablespaceMapping &) = delete;
+
+  /**
+   * @brief get a block, writing into it is a segmentation fault
+   *
+   * @param block_id the id of the block
+   * @return the block
+   * @throw corrupt_page_error if the checksum of its page doesn't match
+   */
+  Block *Get(const size_t &block_id);
+
+  /**
+   * @brief ask the kernel to read a block ahead
+   *
+   * @param block_id the id of the block
+   */
+  void WillNeed(const size_t &block_id);
+};
+
+/**
+ * @brief copy the blocks of the one-file-per-block layout into the
+ * tablespace, a block of the layout before the page headers is put into a
+ * sealed page; the block files are kept (see FileBlockStore::Remove)
+ *
+ * @return the number of blocks migrated
+ */
+size_t MigrateBlockFiles();
@@ -1,145 +1,889 @@
 #include "BufferManager.hpp"
 
-#include <filesystem>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
-#include <limits>
+#include <future>
+#include <iostream>
+#include <new>
 #include <stdexcept>
+#include <thread>
+#include <tuple>
 #include <utility>
 
 #ifdef _DEBUG
 // #define BufferDebug
-#ifdef BufferDebug
-#include <iostream>
-#endif
 #endif
 
-#ifdef ParallelWrite
-#include <sstream>
+std::mutex BufferManager::super_block_mutex_;
+SuperBlock BufferManager::super_block_;
+std::unique_ptr<FrameArena> BufferManager::arena_;
+std::vector<std::unique_ptr<BufferManager::Shard>> BufferManager::shards_;
+#if defined(IoUring)
+std::unique_ptr<BlockStore> BufferManager::store_ =
+    std::make_unique<UringBlockStore>();
+#elif defined(Tablespace)
+std::unique_ptr<BlockStore> BufferManager::store_ =
+    std::make_unique<TablespaceBlockStore>();
+#else
+std::unique_ptr<BlockStore> BufferManager::store_ =
+    std::make_unique<FileBlockStore>();
 #endif
-
-size_t BufferManager::max_block_id_;
-unordered_map<size_t, BufferManager::BlockInfo> BufferManager::buffer_;
+std::unique_ptr<TablespaceMapping> BufferManager::mapping_;
+std::unique_ptr<LogManager> BufferManager::log_;
+bool BufferManager::recovering_ = false;
+std::atomic<bool> BufferManager::sync_commit_ = Config::kSyncCommit;
+std::mutex BufferManager::checkpoint_mutex_;
+std::atomic<std::chrono::steady_clock::time_point>
+    BufferManager::last_checkpoint_ = std::chrono::steady_clock::now();
+std::atomic<size_t> BufferManager::checkpoint_interval_sec_ =
+    Config::kCheckpointIntervalSec;
+std::atomic<size_t> BufferManager::checkpoint_dirty_percent_ =
+    Config::kCheckpointDirtyPercent;
 #ifdef ParallelWrite
-TaskPool BufferManager::task_pool_;
+std::thread BufferManager::flusher_;
+std::mutex BufferManager::flusher_mutex_;
+std::condition_variable BufferManager::flusher_cv_;
+bool BufferManager::flusher_stop_ = false;
+std::atomic<bool> BufferManager::flush_requested_ = false;
 #endif
+std::atomic<size_t> BufferManager::dirty_low_percent_ =
+    Config::kDirtyLowPercent;
+std::atomic<size_t> BufferManager::dirty_high_percent_ =
+    Config::kDirtyHighPercent;
+std::atomic<size_t> BufferManager::flushed_blocks_ = 0;
+std::atomic<size_t> BufferManager::write_runs_ = 0;
+std::atomic<size_t> BufferManager::eviction_writes_ = 0;
+ThreadPool BufferManager::prefetch_pool_(Config::kPrefetchThreadNum);
+std::atomic<size_t> BufferManager::read_ahead_ = Config::kReadAheadBlocks;
+std::array<std::atomic<size_t>, kAccessClassNum> BufferManager::hits_{};
+std::array<std::atomic<size_t>, kAccessClassNum> BufferManager::misses_{};
 BufferManager buffer_manager;
 
-static bool CheckFileExists(const std::string &filename) {
-  return std::filesystem::exists(filename);
+static constexpr MetaKind kMetaKinds[] = {MetaKind::Catalog, MetaKind::Record,
+                                          MetaKind::Index};
+
+/**
+ * @brief get the file where the metadata of a manager is kept
+ */
+static const string &MetaFileName(const MetaKind &kind) {
+  switch (kind) {
+    case MetaKind::Catalog:
+      return Config::kCatalogFileName;
+    case MetaKind::Record:
+      return Config::kRecordFileName;
+    default:
+      return Config::kIndexFileName;
+  }
 }
 
-void BufferManager::WriteToFile(const size_t &block_id, Block *block) {
+void BufferManager::WriteBack(const size_t &block_id, Block *block) {
 #ifdef BufferDebug
   std::cerr << "Writing back block " << block_id << std::endl;
 #endif
+  log_->Flush(block->lsn_);  // the log goes first
+  block->ClearDirty();
+  SealPage(block->page_, block->lsn_);
+  store_->Write(block_id, block->page_);
+  block->rec_lsn_ = 0;
+  eviction_writes_.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t BufferManager::FlushDirty() {
+  std::vector<BufferFrame *> frames;
+  for (auto &shard : shards_) {
+    std::shared_lock lock(shard->mutex_);
+    // a frame being flushed can't be swapped out or freed
+    for (auto &[block_id, frame] : shard->frames_)
+      if (frame.block->IsDirty() && !frame.flushing.exchange(true))
+        frames.push_back(&frame);
+  }
+  std::sort(frames.begin(), frames.end(),
+            [](const BufferFrame *lhs, const BufferFrame *rhs) {
+              return lhs->block_id < rhs->block_id;
+            });
+  // a modification after ClearDirty makes the block dirty again, so it is
+  // written in the next round. Waiting for a latch could deadlock with its
+  // holder, which may wait for the frames being flushed to be swapped out, so
+  // a busy block is left for the next round as well.
+  std::vector<BufferFrame *> batch;
+  std::vector<size_t> block_ids;
+  std::vector<const char *> bufs;
+  size_t flushed = 0;
+  for (size_t i = 0; i < frames.size();) {
+    batch.clear();
+    block_ids.clear();
+    bufs.clear();
+    for (; i < frames.size() && batch.size() < Config::kMaxWriteBatch; i++) {
+      const auto frame = frames[i];
+      if (!frame->block->latch_.try_lock_shared()) {
+        frame->flushing.store(false, std::memory_order_release);
+        continue;
+      }
+      frame->block->ClearDirty();
+      SealPage(frame->block->page_, frame->block->lsn_);
+      batch.push_back(frame);
+      block_ids.push_back(frame->block_id);
+      bufs.push_back(frame->block->page_);
+    }
+    uint64_t lsn = 0;
+    for (const auto &frame : batch)
+      lsn = std::max<uint64_t>(lsn, frame->block->lsn_);
+    size_t runs;
+    try {
+      log_->Flush(lsn);  // the log goes first
+      runs = store_->WriteBatch(block_ids, bufs);
+    } catch (...) {
+      for (const auto &frame : batch) {
+        frame->block->MarkDirty();
+        frame->block->latch_.unlock_shared();
+        frame->flushing.store(false, std::memory_order_release);
+      }
+      for (; i < frames.size(); i++)
+        frames[i]->flushing.store(false, std::memory_order_release);
+      throw;
+    }
+    for (const auto &frame : batch) {
+      frame->block->rec_lsn_ = 0;  // can't be modified until the latch is gone
+      frame->block->latch_.unlock_shared();
+      frame->flushing.store(false, std::memory_order_release);
+    }
+    write_runs_.fetch_add(runs, std::memory_order_relaxed);
+    flushed_blocks_.fetch_add(batch.size(), std::memory_order_relaxed);
+    flushed += batch.size();
+  }
+  return flushed;
+}
+
+bool BufferManager::CheckpointDue() {
+  const auto interval = std::chrono::seconds(checkpoint_interval_sec_);
+  const size_t dirty_percent = checkpoint_dirty_percent_;
+  const auto elapsed =
+      std::chrono::steady_clock::now() - last_checkpoint_.load();
+  return (interval.count() > 0 && elapsed >= interval) ||
+         (dirty_percent > 0 &&
+          Block::DirtyNum() > DirtyThreshold(dirty_percent)) ||
+         log_->Size() > Config::kCheckpointLogSize;
+}
+
+void BufferManager::Checkpoint() {
+  if (mapping_) return;  // nothing is written
+  std::lock_guard checkpoint_lock(checkpoint_mutex_);
+  last_checkpoint_ = std::chrono::steady_clock::now();
+  FlushDirty();
+  // the superblock saved goes with the log kept, a block freed or truncated
+  // after the snapshot is freed again by the replay of its record
+  SuperBlock snapshot;
+  uint64_t redo_lsn;
+  {
+    std::lock_guard lock(super_block_mutex_);
+    snapshot = super_block_;
+    redo_lsn = log_->EndLsn();
+  }
+  // the blocks modified from now on are replayed from their log records, so
+  // the log is kept from the oldest change which may not be on the disk
+  for (auto &shard : shards_) {
+    std::shared_lock lock(shard->mutex_);
+    for (const auto &[block_id, frame] : shard->frames_)
+      if (const uint64_t rec_lsn = frame.block->rec_lsn_; rec_lsn > 0)
+        redo_lsn = std::min(redo_lsn, rec_lsn);
+  }
+  store_->Sync();
+  snapshot.Save(false);
+  SyncFile(Config::kSuperBlockFileName);
+  log_->Checkpoint(redo_lsn);
+}
+
 #ifdef ParallelWrite
-  if (!task_pool_.Exec(block_id, [block_id, block]() {
+void BufferManager::FlushLoop() {
+  std::unique_lock lock(flusher_mutex_);
+  while (!flusher_stop_) {
+    flusher_cv_.wait_for(lock,
+                         std::chrono::milliseconds(Config::kFlushIntervalMs),
+                         [] { return flusher_stop_ || flush_requested_; });
+    if (flusher_stop_) break;
+    const bool requested = flush_requested_.exchange(false);
+    lock.unlock();
+    try {
+      // the commits which don't wait for the log are made durable here
+      if (!sync_commit_) log_->Flush(log_->EndLsn());
+      if (requested || Block::DirtyNum() > DirtyThreshold(dirty_low_percent_))
+        FlushDirty();
+      if (CheckpointDue()) Checkpoint();
+    } catch (const std::exception &e) {
+      std::cerr << "Failed to write back: " << e.what() << std::endl;
+    }
+    lock.lock();
+  }
+}
+
+void BufferManager::StartFlusher() {
+  if (mapping_) return;  // nothing is written
+  flusher_stop_ = false;
+  flusher_ = std::thread(FlushLoop);
+}
+
+void BufferManager::StopFlusher() {
+  {
+    std::lock_guard lock(flusher_mutex_);
+    flusher_stop_ = true;
+  }
+  flusher_cv_.notify_one();
+  if (flusher_.joinable()) flusher_.join();
+}
+
+void BufferManager::WakeFlusher() {
+  if (flush_requested_.exchange(true)) return;
+  std::lock_guard lock(flusher_mutex_);
+  flusher_cv_.notify_one();
+}
 #endif
-#ifdef BufferDebug
-        std::cerr << "Parallel writing back block " << block_id << std::endl;
+
+void BufferManager::Init(const size_t &block_num) {
+  arena_ = std::make_unique<FrameArena>(block_num);
+  store_->RegisterBuffer(arena_->Frames(), arena_->FramesSize());
+#ifdef _DEBUG
+  std::cerr << "Buffer: " << block_num << " blocks, "
+            << (arena_->HugePages() ? "huge pages" : "normal pages")
+            << std::endl;
 #endif
-        std::ofstream os(Block::GetBlockFilename(block_id), std::ios::binary);
-        block->write(os);
-        delete block;
-#ifdef BufferDebug
-        std::cerr << "Written back block " << block_id << std::endl;
+  // a shard should hold enough blocks for the pinned ones and the replacer
+  const size_t shard_num = std::clamp<size_t>(block_num / 64, 1, 16);
+  shards_.clear();
+  shards_.resize(shard_num);
+  for (size_t i = 0; i < shard_num; i++) {
+    shards_[i] = std::make_unique<Shard>();
+#ifdef BufferPolicyClock
+    shards_[i]->replacer_ = std::make_unique<ScanResistantReplacer>(
+        std::make_unique<ClockReplacer>());
+#else
+    shards_[i]->replacer_ = std::make_unique<ScanResistantReplacer>(
+        std::make_unique<LRUReplacer>());
 #endif
-#ifdef ParallelWrite
-      })) {
-    std::stringstream err_msg;
-    err_msg << "Block " << block_id << " is busy";
-    throw std::runtime_error(err_msg.str());
+    shards_[i]->capacity_ = block_num / shard_num + (i < block_num % shard_num);
   }
+}
+
+void BufferManager::SetBlockNum(const size_t &block_num) {
+  if (block_num == 0) throw std::invalid_argument("empty buffer");
+  for (const auto &shard : shards_) {
+    std::shared_lock lock(shard->mutex_);
+    if (!shard->frames_.empty())
+      throw std::logic_error("resizing a buffer in use");
+  }
+#ifdef ParallelWrite
+  StopFlusher();
+#endif
+  Init(block_num);
+#ifdef ParallelWrite
+  StartFlusher();
 #endif
 }
 
+void BufferManager::OpenReadOnly() {
+#ifdef Tablespace
+  std::lock_guard lock(super_block_mutex_);
+  bool clean = false;
+  if (!super_block_.Load(clean)) throw std::runtime_error("no superblock");
+  // the recovery would write the blocks and the log
+  if (!clean)
+    throw std::runtime_error("not shut down cleanly, open it for writing once");
+  mapping_ = std::make_unique<TablespaceMapping>(super_block_.BlockCount());
+#else
+  throw std::logic_error("the read-only mode requires the tablespace");
+#endif
+}
+
+void BufferManager::SetDirtyLowPercent(const size_t &percent) {
+  if (percent > 100) throw std::invalid_argument("more than 100%");
+  dirty_low_percent_ = percent;
+}
+
+void BufferManager::SetDirtyHighPercent(const size_t &percent) {
+  if (percent > 100) throw std::invalid_argument("more than 100%");
+  dirty_high_percent_ = percent;
+}
+
+void BufferManager::SetCheckpointDirtyPercent(const size_t &percent) {
+  if (percent > 100) throw std::invalid_argument("more than 100%");
+  checkpoint_dirty_percent_ = percent;
+}
+
+/**
+ * @brief read a number from the environment
+ *
+ * @param name the name of the environment variable
+ * @param value the number, unchanged if the variable is unset or invalid
+ * @param allow_zero whether 0 is valid
+ */
+static void GetEnv(const char *name, size_t &value, bool allow_zero) {
+  const auto env = std::getenv(name);
+  if (env == nullptr) return;
+  char *end;
+  const auto number = std::strtoull(env, &end, 10);
+  if (*env && !*end && (allow_zero || number > 0))
+    value = number;
+  else
+    std::cerr << "Ignored invalid " << name << "=" << env << std::endl;
+}
+
 BufferManager::BufferManager() {
-  size_t l = std::numeric_limits<size_t>::min(),
-         r = std::numeric_limits<size_t>::max();
-  while (l != r) {
-    auto m = (l + r) >> 1;
-    if (CheckFileExists(Block::GetBlockFilename(m)))
-      l = m + 1;
-    else
-      r = m;
+  size_t block_num = Config::kMaxBlockNum, read_ahead = read_ahead_,
+         dirty_low = dirty_low_percent_, dirty_high = dirty_high_percent_,
+         sync_commit = sync_commit_,
+         checkpoint_interval = checkpoint_interval_sec_,
+         checkpoint_dirty = checkpoint_dirty_percent_, read_only = 0;
+  GetEnv(Config::kReadOnlyEnv, read_only, true);
+  GetEnv(Config::kBufferBlocksEnv, block_num, false);
+  GetEnv(Config::kReadAheadEnv, read_ahead, true);
+  GetEnv(Config::kDirtyLowEnv, dirty_low, true);
+  GetEnv(Config::kDirtyHighEnv, dirty_high, true);
+  GetEnv(Config::kSyncCommitEnv, sync_commit, true);
+  GetEnv(Config::kCheckpointIntervalEnv, checkpoint_interval, true);
+  GetEnv(Config::kCheckpointDirtyEnv, checkpoint_dirty, true);
+  read_ahead_ = read_ahead;
+  sync_commit_ = sync_commit != 0;
+  checkpoint_interval_sec_ = checkpoint_interval;
+  checkpoint_dirty_percent_ = std::min<size_t>(checkpoint_dirty, 100);
+  dirty_low_percent_ = std::min<size_t>(dirty_low, 100);
+  dirty_high_percent_ = std::min<size_t>(dirty_high, 100);
+  Init(block_num);
+  log_ = std::make_unique<LogManager>(read_only != 0);
+  if (read_only != 0) {
+    try {
+      OpenReadOnly();
+    } catch (const std::exception &e) {
+      // during the static initialization, nobody can catch it
+      std::cerr << "Can't open the database read-only: " << e.what()
+                << std::endl;
+      std::exit(1);
+    }
+  } else {
+    Open();
   }
-  max_block_id_ = l;
+  last_checkpoint_ = std::chrono::steady_clock::now();
+#ifdef ParallelWrite
+  StartFlusher();
+#endif
 }
 
 BufferManager::~BufferManager() {
-  for (const auto &it : buffer_) {
-    if (it.second.block->dirty_)
-      WriteToFile(it.first, it.second.block);
-    else
-      delete it.second.block;
-  }
-}
-
-void BufferManager::AddBlockToBuffer(const size_t &block_id,
-                                     Block *const block) {
-  auto block_info = BlockInfo{block, std::chrono::high_resolution_clock::now()};
-  if (buffer_.size() == Config::kMaxBlockNum) {
-    size_t least_recently_used_block_id;
-    Block *least_recently_used_block = nullptr;
-    auto least_recently_used_time =
-        std::chrono::high_resolution_clock::now() +
-        std::chrono::seconds(1);  // +1s to solve the resolution problem
-    for (const auto &it : buffer_) {
-      if (!it.second.block->pin_ &&
-          it.second.last_access_time < least_recently_used_time) {
-        least_recently_used_block_id = it.first;
-        least_recently_used_block = it.second.block;
-        least_recently_used_time = it.second.last_access_time;
+  prefetch_pool_.Stop(false);  // drop the pending prefetches
+#ifdef ParallelWrite
+  StopFlusher();
+#endif
+  FlushDirty();
+#ifdef _DEBUG
+  static const char *const kAccessClassNames[] = {"other", "scan", "point",
+                                                  "index", "prefetch"};
+  const auto stats = HitStats();
+  for (size_t i = 0; i < kAccessClassNum; i++) {
+    if (stats[i].hits + stats[i].misses == 0) continue;
+    std::cerr << "Buffer " << kAccessClassNames[i] << ": " << stats[i].hits
+              << " hits, " << stats[i].misses << " misses" << std::endl;
+  }
+  const auto flush_stats = FlushStatistics();
+  std::cerr << "Buffer write-back: " << flush_stats.flushed_blocks
+            << " blocks flushed in " << flush_stats.write_runs << " writes, "
+            << flush_stats.eviction_writes << " written by evictions"
+            << std::endl;
+  const auto log_stats = LogStatistics();
+  std::cerr << "Log: " << log_stats.records << " records, " << log_stats.bytes
+            << " bytes in " << log_stats.syncs << " syncs, "
+            << log_stats.checkpoints << " checkpoints" << std::endl;
+#endif
+  for (auto &shard : shards_) {
+    std::unique_lock lock(shard->mutex_);
+    for (const auto &it : shard->frames_) arena_->Release(it.second.block);
+    shard->frames_.clear();
+  }
+  if (mapping_) return;  // nothing has been written
+  Truncate();
+  // the managers have written their files, the log isn't needed once
+  // everything is on the disk
+  store_->Sync();
+  for (const auto &kind : kMetaKinds) SyncFile(MetaFileName(kind));
+  {
+    std::lock_guard lock(super_block_mutex_);
+    super_block_.Save(true);
+  }
+  SyncFile(Config::kSuperBlockFileName);
+  log_->Reset();
+}
+
+void BufferManager::Open() {
+  bool opened_clean;
+  {
+    std::lock_guard lock(super_block_mutex_);
+    bool clean = false;
+    const bool loaded = super_block_.Load(clean);
+    opened_clean = loaded && clean;
+    // without a log, the blocks allocated and freed since the superblock was
+    // saved are unknown
+    if (!loaded || (!clean && !log_->Existed()))
+      super_block_.Reset(store_->Size());
+  }
+  if (!opened_clean && log_->Existed()) {
+    Recover();
+    return;
+  }
+  log_->Reset();
+  std::lock_guard lock(super_block_mutex_);
+  // until the clean shutdown, the superblock on the disk falls behind the
+  // log, which is replayed on top of it after a crash
+  super_block_.Save(false);
+  SyncFile(Config::kSuperBlockFileName);
+}
+
+void BufferManager::Recover() {
+  recovering_ = true;
+  string meta[std::size(kMetaKinds)];
+  bool has_meta[std::size(kMetaKinds)] = {};
+  const auto count = log_->Replay([&](const LogRecord &record) {
+    switch (record.type) {
+      case LogRecordType::Update: {
+        bool reused;
+        {
+          // the block was freed before the superblock was saved, its Free
+          // record comes later in the log
+          std::lock_guard lock(super_block_mutex_);
+          reused = record.block_id >= super_block_.BlockCount() ||
+                   super_block_.IsFree(record.block_id);
+          if (reused) super_block_.Take(record.block_id);
+        }
+        const auto block =
+            reused ? NewBlock(record.block_id, PageType::Other)
+                   : Fetch(record.block_id, AccessClass::Other);
+        memcpy(block->val_ + record.offset, record.data.data(),
+               record.data.size());
+        block->MarkDirty();
+        block->Unpin();
+        break;
+      }
+      case LogRecordType::Alloc: {
+        {
+          std::lock_guard lock(super_block_mutex_);
+          super_block_.Take(record.block_id);
+        }
+        NewBlock(record.block_id, record.page_type)->Unpin();
+        break;
       }
+      case LogRecordType::Free:
+        Free(record.block_id);
+        break;
+      case LogRecordType::Meta: {
+        const auto kind = static_cast<size_t>(record.kind);
+        meta[kind] = record.data;
+        has_meta[kind] = true;
+        break;
+      }
+    }
+  });
+  // the same order as the shutdown, so that a crash in the middle only
+  // replays the log again
+  FlushDirty();
+  store_->Sync();
+  for (size_t i = 0; i < std::size(kMetaKinds); i++) {
+    if (!has_meta[i]) continue;
+    {
+      std::ofstream os(MetaFileName(kMetaKinds[i]), std::ios::binary);
+      os.write(meta[i].data(), meta[i].size());
+    }
+    SyncFile(MetaFileName(kMetaKinds[i]));
+  }
+  recovering_ = false;
+  Truncate();
+  {
+    std::lock_guard lock(super_block_mutex_);
+    super_block_.Save(false);
+  }
+  SyncFile(Config::kSuperBlockFileName);
+  log_->Reset();
+  if (count)
+    std::cerr << "Recovered " << count << " records from the log" << std::endl;
+}
+
+std::pair<BufferFrame *, bool> BufferManager::AddBlockToBuffer(
+    Shard &shard, std::unique_lock<std::shared_mutex> &lock,
+    const size_t &block_id, bool scan) {
+  auto backoff = std::chrono::microseconds(1);
+  while (shard.frames_.size() >= shard.capacity_) {
+#ifdef ParallelWrite
+    // the flusher keeps enough clean blocks so that evictions don't write
+    auto victim = shard.replacer_->Victim(true);
+    if (victim == nullptr) {  // unless it falls behind
+      victim = shard.replacer_->Victim(false);
+      WakeFlusher();
     }
-    if (least_recently_used_block == nullptr)
-      throw std::overflow_error("buffer overflow");
+#else
+    auto victim = shard.replacer_->Victim(false);
+#endif
+    if (victim == nullptr) {
+      // the unpinned frames may all be in the middle of a write back, which
+      // doesn't need the latch of the shard to finish; wait for it without
+      // the latch, so that the hits on the shard and the next round of the
+      // flusher aren't held up meanwhile
+      const auto flushing = std::any_of(
+          shard.frames_.begin(), shard.frames_.end(), [](const auto &entry) {
+            return entry.second.flushing.load(std::memory_order_acquire) &&
+                   entry.second.block->pin_count_.load() == 0;
+          });
+      if (!flushing) throw std::overflow_error("buffer overflow");
+      lock.unlock();
+      std::this_thread::sleep_for(backoff);
+      backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+      lock.lock();
+      // another thread may have brought the block in meanwhile
+      const auto iter = shard.frames_.find(block_id);
+      if (iter != shard.frames_.end()) return {&iter->second, false};
+      continue;
+    }
+    const auto victim_block_id = victim->block_id;
+    const auto victim_block = victim->block;
 #ifdef BufferDebug
-    std::cerr << "Swap out block " << least_recently_used_block_id << std::endl;
+    std::cerr << "Swap out block " << victim_block_id << std::endl;
 #endif
-    buffer_.erase(least_recently_used_block_id);
-    if (least_recently_used_block->dirty_)
-      WriteToFile(least_recently_used_block_id, least_recently_used_block);
-    else
-      delete least_recently_used_block;
+    shard.replacer_->Erase(victim);
+    shard.frames_.erase(victim_block_id);
+    if (victim_block->IsDirty()) WriteBack(victim_block_id, victim_block);
+    arena_->Release(victim_block);
   }
-  buffer_.insert(std::make_pair(block_id, block_info));
+  auto &frame =
+      shard.frames_.try_emplace(block_id, block_id, arena_->Allocate())
+          .first->second;
+  if (scan)
+    shard.replacer_->InsertScan(&frame);
+  else
+    shard.replacer_->Insert(&frame);
+#ifdef ParallelWrite
+  if (Block::DirtyNum() > DirtyThreshold(dirty_high_percent_)) WakeFlusher();
+#endif
+  return {&frame, true};
 }
 
-Block *BufferManager::Read(const size_t &block_id) {
+Block *BufferManager::Read(const size_t &block_id, const AccessClass &cls) {
 #ifdef BufferDebug
   std::cerr << "Read block " << block_id << std::endl;
 #endif
-  if (block_id == max_block_id_) {
-    Block *block = new Block;
-    Create(block);
+  if (mapping_) {  // the superblock doesn't change any more
+    if (super_block_.IsFree(block_id))
+      throw std::out_of_range("block_id out of range");
+    const auto block = mapping_->Get(block_id);
+    block->Pin();
     return block;
   }
-  if (block_id > max_block_id_)
-    throw std::out_of_range("block_id out of range");
-  auto iter = buffer_.find(block_id);
-  if (iter == buffer_.end()) {
-#ifdef ParallelWrite
-    task_pool_.Wait(block_id);
+  return Fetch(block_id, cls);
+}
+
+void BufferManager::Prefetch(std::vector<size_t> block_ids) {
+#ifdef BufferDebug
+  std::cerr << "Prefetch " << block_ids.size() << " blocks" << std::endl;
 #endif
-    std::ifstream is(Block::GetBlockFilename(block_id), std::ios::binary);
-    auto block = new Block;
-    block->read(is);
-    AddBlockToBuffer(block_id, block);
+  if (mapping_) {
+    for (const auto &block_id : block_ids) mapping_->WillNeed(block_id);
+    return;
+  }
+  prefetch_pool_.push([block_ids = std::move(block_ids)](int) {
+    try {
+      FetchBatch(block_ids);
+    } catch (const std::exception &) {
+      // it is only a hint anyway
+    }
+  });
+}
+
+Block *BufferManager::Fetch(const size_t &block_id, const AccessClass &cls) {
+  auto &shard = ShardOf(block_id);
+  const auto cls_no = static_cast<size_t>(cls);
+  const bool scan = cls == AccessClass::Scan;
+  // a scan doesn't count as a reference, so the frames it passes by age
+  const auto hit = [&](BufferFrame &frame) {
+    hits_[cls_no].fetch_add(1, std::memory_order_relaxed);
+    frame.block->Pin();
+    if (!scan) shard.replacer_->Access(&frame);
+    return frame.block;
+  };
+  // a block being loaded is latched exclusively by the loader until it is
+  // ready, so a hit on it waits for the latch
+  const auto wait_loaded = [&](BufferFrame &frame) {
+    if (frame.loading.load(std::memory_order_acquire))
+      std::shared_lock latch(frame.block->latch_);
+    if (frame.corrupt.load(std::memory_order_acquire)) {
+      frame.block->Unpin();
+      throw CorruptPage(block_id);
+    }
+  };
+  {
+    std::shared_lock lock(shard.mutex_);
+    auto iter = shard.frames_.find(block_id);
+    if (iter != shard.frames_.end()) {
+      const auto block = hit(iter->second);
+      lock.unlock();
+      wait_loaded(iter->second);
+      return block;
+    }
+  }
+  {
+    std::lock_guard lock(super_block_mutex_);
+    if (block_id >= super_block_.BlockCount() ||
+        super_block_.IsFree(block_id))
+      throw std::out_of_range("block_id out of range");
+  }
+  std::unique_lock lock(shard.mutex_);
+  auto iter = shard.frames_.find(block_id);
+  if (iter != shard.frames_.end()) {  // loaded by another thread meanwhile
+    const auto block = hit(iter->second);
+    lock.unlock();
+    wait_loaded(iter->second);
     return block;
   }
-  iter->second.last_access_time = std::chrono::high_resolution_clock::now();
-  return iter->second.block;
+  const auto [added, inserted] = AddBlockToBuffer(shard, lock, block_id, scan);
+  if (!inserted) {
+    const auto block = hit(*added);
+    lock.unlock();
+    wait_loaded(*added);
+    return block;
+  }
+  misses_[cls_no].fetch_add(1, std::memory_order_relaxed);
+  auto &frame = *added;
+  const auto block = frame.block;
+  block->Pin();
+  std::unique_lock latch(block->latch_);
+  frame.loading = true;
+  lock.unlock();
+  // the frame stays in the buffer when the read fails, so that nobody sees it
+  // half loaded; it is clean and goes with the next eviction
+  try {
+    store_->Read(block_id, block->page_);
+  } catch (...) {
+    frame.corrupt = true;
+    frame.loading.store(false, std::memory_order_release);
+    block->Unpin();
+    throw;
+  }
+  if (!VerifyPage(block->page_)) {
+    frame.corrupt = true;
+    frame.loading.store(false, std::memory_order_release);
+    block->Unpin();
+    throw CorruptPage(block_id);
+  }
+  block->lsn_ = HeaderOf(block->page_).lsn;
+  frame.loading.store(false, std::memory_order_release);
+  return block;
 }
 
-size_t BufferManager::Create(Block *block) {
-  const auto block_id = max_block_id_++;
+void BufferManager::FetchBatch(const std::vector<size_t> &block_ids) {
+  constexpr auto cls_no = static_cast<size_t>(AccessClass::Prefetch);
+  std::vector<BufferFrame *> frames;
+  std::vector<size_t> ids;
+  std::vector<char *> bufs;
+  for (const auto &block_id : block_ids) {
+    {
+      std::lock_guard lock(super_block_mutex_);
+      if (block_id >= super_block_.BlockCount() ||
+          super_block_.IsFree(block_id))
+        continue;
+    }
+    auto &shard = ShardOf(block_id);
+    std::unique_lock lock(shard.mutex_);
+    if (shard.frames_.count(block_id)) {
+      hits_[cls_no].fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    BufferFrame *frame;
+    bool inserted;
+    try {
+      std::tie(frame, inserted) = AddBlockToBuffer(shard, lock, block_id, true);
+    } catch (const std::overflow_error &) {
+      break;  // the buffer is full of pinned blocks, read what we have got
+    }
+    if (!inserted) {
+      hits_[cls_no].fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    misses_[cls_no].fetch_add(1, std::memory_order_relaxed);
+    // pinned and latched until it is loaded, nobody waits for the latch of a
+    // loading frame while holding another lock
+    frame->block->Pin();
+    frame->block->latch_.lock();
+    frame->loading = true;
+    frames.push_back(frame);
+    ids.push_back(block_id);
+    bufs.push_back(frame->block->page_);
+  }
+  const auto finish = [&frames](bool read) {
+    for (const auto &frame : frames) {
+      const auto page = frame->block->page_;
+      if (!read || !VerifyPage(page))
+        frame->corrupt = true;  // the Read of the block throws
+      else
+        frame->block->lsn_ = HeaderOf(page).lsn;
+      frame->loading.store(false, std::memory_order_release);
+      frame->block->latch_.unlock();
+      frame->block->Unpin();
+    }
+  };
+  try {
+    store_->ReadBatch(ids, bufs);
+  } catch (...) {
+    finish(false);
+    throw;
+  }
+  finish(true);
+}
+
+Block *BufferManager::NewBlock(const size_t &block_id, const PageType &type) {
+  auto &shard = ShardOf(block_id);
+  std::unique_lock lock(shard.mutex_);
+  const auto iter = shard.frames_.find(block_id);  // only when replaying
+  auto &frame = iter != shard.frames_.end()
+                    ? iter->second
+                    : *AddBlockToBuffer(shard, lock, block_id, false).first;
+  const auto block = frame.block;
+  frame.corrupt = false;
+  InitPage(block->page_, type);
+  block->MarkDirty();
+  block->Pin();
+  return block;
+}
+
+Block *BufferManager::Create(size_t &block_id, const PageType &type) {
+  if (mapping_) throw read_only_error("creating a block");
+  {
+    std::lock_guard lock(super_block_mutex_);
+    block_id = super_block_.Allocate();
+  }
 #ifdef BufferDebug
   std::cerr << "Create block " << block_id << std::endl;
 #endif
-  block->dirty_ = true;
-  AddBlockToBuffer(block_id, block);
-  return block_id;
+  const auto block = NewBlock(block_id, type);
+  if (!recovering_)
+    block->lsn_ = log_->LogAlloc(block_id, type, block->rec_lsn_);
+  return block;
+}
+
+size_t BufferManager::NextId() {
+  std::lock_guard lock(super_block_mutex_);
+  return super_block_.NextId();
+}
+
+void BufferManager::Free(const size_t &block_id) {
+#ifdef BufferDebug
+  std::cerr << "Free block " << block_id << std::endl;
+#endif
+  if (mapping_) throw read_only_error("freeing a block");
+  // a free that is refused must not reach the log, or the replay would do it
+  auto logged = recovering_;
+  for (auto &shard = ShardOf(block_id);;) {
+    std::unique_lock lock(shard.mutex_);
+    auto iter = shard.frames_.find(block_id);
+    if (iter != shard.frames_.end() && iter->second.block->pin_count_ > 0)
+      throw std::logic_error("freeing a pinned block");
+    if (!logged) {
+      log_->LogFree(block_id);
+      logged = true;
+    }
+    if (iter == shard.frames_.end()) break;
+    if (iter->second.flushing) {  // wait for the flusher to write it
+      lock.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+    shard.replacer_->Erase(&iter->second);
+    iter->second.block->ClearDirty();
+    arena_->Release(iter->second.block);
+    shard.frames_.erase(iter);
+    break;
+  }
+  store_->Discard(block_id);
+  std::lock_guard lock(super_block_mutex_);
+  super_block_.Free(block_id);
+}
+
+void BufferManager::LogUpdate(const size_t &block_id, Block *block,
+                              const size_t &offset, const size_t &size) {
+  if (recovering_) return;
+  block->lsn_ = log_->LogUpdate(block_id, block->val_ + offset, offset, size,
+                                block->rec_lsn_);
 }
 
-size_t BufferManager::NextId() { return max_block_id_; }
+void BufferManager::LogMeta(const MetaKind &kind, std::string_view snapshot) {
+  if (!recovering_) log_->LogMeta(kind, snapshot);
+}
+
+void BufferManager::Commit() {
+  if (sync_commit_ || log_->Pending() >= Config::kLogBufferSize)
+    log_->Flush(log_->EndLsn());
+#ifndef ParallelWrite
+  // no flusher to take the checkpoints in the background
+  if (CheckpointDue()) Checkpoint();
+#endif
+}
+
+ScrubStats BufferManager::Scrub() {
+  std::vector<size_t> block_ids;
+  {
+    std::lock_guard lock(super_block_mutex_);
+    for (size_t block_id = 0; block_id < super_block_.BlockCount(); block_id++)
+      if (!super_block_.IsFree(block_id)) block_ids.push_back(block_id);
+  }
+  // the pages are read past the buffer, each task reads a batch of them
+  ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::future<std::vector<size_t>>> tasks;
+  for (size_t first = 0; first < block_ids.size();
+       first += Config::kScrubBatch) {
+    tasks.push_back(pool.push([&block_ids, first](int) {
+      const std::vector<size_t> ids(
+          block_ids.begin() + first,
+          block_ids.begin() +
+              std::min(first + Config::kScrubBatch, block_ids.size()));
+      const std::unique_ptr<char, decltype(&std::free)> pages(
+          static_cast<char *>(std::aligned_alloc(
+              Config::kDirectIOAlignment, ids.size() * Config::kPageSize)),
+          std::free);
+      if (!pages) throw std::bad_alloc();
+      std::vector<char *> bufs;
+      for (size_t i = 0; i < ids.size(); i++)
+        bufs.push_back(pages.get() + i * Config::kPageSize);
+      store_->ReadBatch(ids, bufs);
+      std::vector<size_t> corrupted;
+      for (size_t i = 0; i < ids.size(); i++)
+        if (!VerifyPage(bufs[i])) corrupted.push_back(ids[i]);
+      return corrupted;
+    }));
+  }
+  ScrubStats stats{block_ids.size(), {}};
+  for (auto &task : tasks) {
+    const auto corrupted = task.get();
+    stats.corrupted.insert(stats.corrupted.end(), corrupted.begin(),
+                           corrupted.end());
+  }
+  return stats;
+}
+
+size_t BufferManager::Truncate() {
+  std::lock_guard lock(super_block_mutex_);
+  const auto count = super_block_.Truncate();
+  if (count) store_->Truncate(super_block_.BlockCount());
+  return count;
+}
+
+FreeSpaceStats BufferManager::FreeSpace() {
+  std::lock_guard lock(super_block_mutex_);
+  return super_block_.Stats();
+}
+
+std::array<AccessStats, kAccessClassNum> BufferManager::HitStats() {
+  std::array<AccessStats, kAccessClassNum> stats;
+  for (size_t i = 0; i < kAccessClassNum; i++)
+    stats[i] = {hits_[i].load(std::memory_order_relaxed),
+                misses_[i].load(std::memory_order_relaxed)};
+  return stats;
+}
+
+FlushStats BufferManager::FlushStatistics() {
+  return {flushed_blocks_.load(std::memory_order_relaxed),
+          write_runs_.load(std::memory_order_relaxed),
+          eviction_writes_.load(std::memory_order_relaxed)};
+}
@@ -1,39 +1,207 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 using std::unordered_map;
 
+#include "BlockStore.hpp"
 #include "DataStructure.hpp"
+#include "FrameArena.hpp"
+#include "LogManager.hpp"
+#include "Page.hpp"
+#include "Replacer.hpp"
+#include "SuperBlock.hpp"
+#include "ThreadPool.hpp"
 #ifdef ParallelWrite
-#include "TaskPool.hpp"
+#include <condition_variable>
+#include <thread>
 #endif
 
+/**
+ * @brief who reads a block, decides how the block is cached
+ */
+enum struct AccessClass {
+  Other,
+  Scan,      // sequential scans of the records, don't evict the others
+  Point,     // records located by an index
+  Index,     // index nodes
+  Prefetch,  // read-ahead of the scans, only used internally
+};
+constexpr size_t kAccessClassNum = 5;
+
+struct AccessStats {
+  size_t hits, misses;
+};
+
+struct ScrubStats {
+  size_t checked_pages;
+  std::vector<size_t> corrupted;  // the ids of the blocks, in ascending order
+};
+
+struct FlushStats {
+  size_t flushed_blocks;   // written back by the flusher
+  size_t write_runs;       // writes issued by the flusher, after coalescing
+  size_t eviction_writes;  // dirty blocks written back by the evictions
+};
+
 // CAUTION: should have only **ONE** instance at a time
+// Thread-safe. Lock order: super_block_mutex_ -> Shard::mutex_ -> Block::latch_
 class BufferManager {
-  static size_t max_block_id_;
-  struct BlockInfo {
-    Block *const block;
-    std::chrono::time_point<std::chrono::system_clock> last_access_time;
+  /**
+   * @brief a part of the buffer, a block belongs to the shard
+   * `block_id % shards_.size()`
+   */
+  struct Shard {
+    std::shared_mutex mutex_;  // shared: hits, exclusive: the others
+    unordered_map<size_t, BufferFrame> frames_;
+    std::unique_ptr<Replacer> replacer_;
+    size_t capacity_;
   };
-  static unordered_map<size_t, BlockInfo> buffer_;
+
+  static std::mutex super_block_mutex_;
+  static SuperBlock super_block_;
+  static std::unique_ptr<FrameArena> arena_;
+  static std::vector<std::unique_ptr<Shard>> shards_;
+  static std::unique_ptr<BlockStore> store_;
+  static std::unique_ptr<TablespaceMapping> mapping_;  // in read-only mode
+  static std::unique_ptr<LogManager> log_;
+  static bool recovering_;  // replaying the log, which isn't appended to
+  static std::atomic<bool> sync_commit_;
+  static std::mutex checkpoint_mutex_;  // one checkpoint at a time
+  static std::atomic<std::chrono::steady_clock::time_point> last_checkpoint_;
+  static std::atomic<size_t> checkpoint_interval_sec_,
+      checkpoint_dirty_percent_;
 #ifdef ParallelWrite
-  static TaskPool task_pool_;
+  static std::thread flusher_;
+  static std::mutex flusher_mutex_;  // protects flusher_stop_
+  static std::condition_variable flusher_cv_;
+  static bool flusher_stop_;
+  static std::atomic<bool> flush_requested_;
 #endif
+  static std::atomic<size_t> dirty_low_percent_, dirty_high_percent_;
+  static std::atomic<size_t> flushed_blocks_, write_runs_, eviction_writes_;
+  static ThreadPool prefetch_pool_;
+  static std::atomic<size_t> read_ahead_;
+  static std::array<std::atomic<size_t>, kAccessClassNum> hits_, misses_;
+
+  /**
+   * @brief (re)build the arena and the shards
+   *
+   * @param block_num the number of blocks in the buffer
+   */
+  static void Init(const size_t &block_num);
+
+  static Shard &ShardOf(const size_t &block_id) {
+    return *shards_[block_id % shards_.size()];
+  }
+
+  /**
+   * @brief add a block taken from the arena into the buffer, swap out another
+   * one first if the shard is full (CAUTION: the shard should be locked
+   * exclusively, the lock is released while waiting for a write back)
+   *
+   * @param shard the shard of the block
+   * @param lock the exclusive lock of the shard held by the caller
+   * @param block_id the id of the block
+   * @param scan whether the block is brought in by a sequential scan
+   * @return the frame of the block and true, its block is unpinned and clean;
+   * or the frame and false if another thread added the block while the lock
+   * was released
+   */
+  static std::pair<BufferFrame *, bool> AddBlockToBuffer(
+      Shard &shard, std::unique_lock<std::shared_mutex> &lock,
+      const size_t &block_id, bool scan);
+
+  /**
+   * @brief add a zeroed block into the buffer and pin it
+   *
+   * @param block_id the id of the block, already allocated
+   * @param type the type of its page
+   * @return a pointer to the block, dirty
+   */
+  static Block *NewBlock(const size_t &block_id, const PageType &type);
 
   /**
-   * @brief add a block into the buffer
+   * @brief replay the log on top of the blocks and the metadata on the disk,
+   * then make the result durable and empty the log
+   */
+  static void Recover();
+
+  /**
+   * @brief write back a dirty block which is no longer in the buffer
    *
    * @param block_id the id of the block
    * @param block a pointer to the block
    */
-  static void AddBlockToBuffer(const size_t &block_id, Block *const block);
+  static void WriteBack(const size_t &block_id, Block *block);
 
-  static void WriteToFile(const size_t &block_id, Block *block);
+  /**
+   * @brief write back every dirty block in the buffer, sorted by id so that
+   * the blocks with consecutive ids are written together
+   *
+   * @return the number of blocks written
+   */
+  static size_t FlushDirty();
+
+  /**
+   * @brief whether the interval, the dirty blocks or the size of the log
+   * calls for a checkpoint
+   */
+  static bool CheckpointDue();
+
+#ifdef ParallelWrite
+  /**
+   * @brief the loop of the flusher thread
+   */
+  static void FlushLoop();
+
+  static void StartFlusher();
+  static void StopFlusher();
+
+  /**
+   * @brief ask the flusher to write back the dirty blocks now
+   */
+  static void WakeFlusher();
+#endif
+
+  /**
+   * @brief convert a percentage of the buffer to a number of blocks
+   */
+  static size_t DirtyThreshold(const size_t &percent) {
+    return BlockNum() * percent / 100;
+  }
+
+  /**
+   * @brief get a block into the buffer
+   *
+   * @param block_id the id of the block
+   * @param cls who reads the block
+   * @return a pointer to the pinned block
+   */
+  static Block *Fetch(const size_t &block_id, const AccessClass &cls);
+
+  /**
+   * @brief get the blocks which are not buffered yet into the buffer with
+   * one batched read, the blocks which don't exist are skipped
+   *
+   * @param block_ids the ids of the blocks
+   */
+  static void FetchBatch(const std::vector<size_t> &block_ids);
 
  public:
   /**
-   * @brief Construct a new Buffer Manager object. Open the files.
+   * @brief Construct a new Buffer Manager object. Open the files, read-only if
+   * the environment variable Config::kReadOnlyEnv is 1. The size of the buffer
+   * is taken from the environment variable Config::kBufferBlocksEnv if it is
+   * set.
    *
    */
   BufferManager();
@@ -46,27 +214,220 @@ class BufferManager {
   ~BufferManager();
 
   /**
-   * @brief read a block
+   * @brief load the superblock and replay the log if the last run didn't shut
+   * down cleanly, or rebuild the superblock from the block store if it is
+   * missing or stale without a log
+   *
+   */
+  static void Open();
+
+  /**
+   * @brief change the number of blocks in the buffer (CAUTION: should be
+   * called before any block is read)
+   *
+   * @param block_num the number of blocks
+   */
+  static void SetBlockNum(const size_t &block_num);
+
+  /**
+   * @brief open the database read-only instead of Open: the data files of the
+   * tablespace are mapped, and the blocks are read in place instead of being
+   * copied into the buffer; nothing is written, so a database which wasn't
+   * shut down cleanly is refused rather than recovered
+   */
+  static void OpenReadOnly();
+
+  static bool ReadOnly() { return mapping_ != nullptr; }
+
+  /**
+   * @brief get the number of blocks in the buffer
+   */
+  static size_t BlockNum() { return arena_->BlockNum(); }
+
+  /**
+   * @brief set the percentage of the buffer above which the dirty blocks are
+   * written back in the background
+   *
+   * @param percent the percentage
+   */
+  static void SetDirtyLowPercent(const size_t &percent);
+
+  /**
+   * @brief set the percentage of the buffer above which the flusher is woken
+   * up at once instead of at its next tick
+   *
+   * @param percent the percentage
+   */
+  static void SetDirtyHighPercent(const size_t &percent);
+
+  /**
+   * @brief set the number of seconds between two checkpoints
+   *
+   * @param seconds the number of seconds, 0 disables the periodic checkpoints
+   */
+  static void SetCheckpointInterval(const size_t &seconds) {
+    checkpoint_interval_sec_ = seconds;
+  }
+
+  /**
+   * @brief set the percentage of the buffer above which the dirty blocks
+   * trigger a checkpoint
+   *
+   * @param percent the percentage, 0 disables the trigger
+   */
+  static void SetCheckpointDirtyPercent(const size_t &percent);
+
+  /**
+   * @brief take a fuzzy checkpoint: write back the dirty blocks and the
+   * superblock, then drop the log records before the oldest change which
+   * isn't on the disk, the statements can go on in the meantime
+   */
+  static void Checkpoint();
+
+  /**
+   * @brief read a block and pin it, a hit only takes the shared latch of its
+   * shard, a miss verifies the checksum of the page (CAUTION: call
+   * Block::Unpin when the block is no longer used)
    *
    * @param block_id the id of the block
+   * @param cls who reads the block
    * @return a pointer to the block
+   * @throw corrupt_page_error if the page of the block is corrupted
    */
-  static Block *Read(const size_t &block_id);
+  static Block *Read(const size_t &block_id,
+                     const AccessClass &cls = AccessClass::Other);
 
   /**
-   * @brief create a new block (CAUTION: the block should **NOT** be deleted)
+   * @brief load blocks into the buffer in the background without pinning
+   * them, a later Read of such a block waits for it if it is still loading
    *
-   * @param block a pointer to the block
-   * @return the id of the block
+   * @param block_ids the ids of the blocks, in the order to be loaded
    */
-  static size_t Create(Block *block);
+  static void Prefetch(std::vector<size_t> block_ids);
 
   /**
-   * @brief get the id of the next new block
+   * @brief set the number of blocks a sequential scan reads ahead
+   *
+   * @param block_num the number of blocks, 0 disables read-ahead
+   */
+  static void SetReadAhead(const size_t &block_num) {
+    read_ahead_ = block_num;
+  }
+
+  /**
+   * @brief get the number of blocks a sequential scan reads ahead, at most a
+   * quarter of the buffer
+   */
+  static size_t ReadAhead() {
+    return std::min<size_t>(read_ahead_, BlockNum() / 4);
+  }
+
+  /**
+   * @brief create a new zeroed block and pin it (CAUTION: the block should
+   * **NOT** be deleted, call Block::Unpin when it is no longer used)
+   *
+   * @param block_id the id of the block
+   * @param type the type of its page
+   * @return a pointer to the block
+   */
+  static Block *Create(size_t &block_id,
+                       const PageType &type = PageType::Other);
+
+  /**
+   * @brief get the id of the next new block (only a hint if other threads
+   * create blocks at the same time)
    *
    * @return the id of the next new block
    */
   static size_t NextId();
+
+  /**
+   * @brief free a block, its id can be reused by later created blocks
+   * (CAUTION: the block is dropped from the buffer without being written back,
+   * it shouldn't be pinned)
+   *
+   * @param block_id the id of the block
+   */
+  static void Free(const size_t &block_id);
+
+  /**
+   * @brief log the new bytes of a part of a block (CAUTION: call it with
+   * Block::latch_ held exclusively, after the bytes are modified)
+   *
+   * @param block_id the id of the block
+   * @param block a pointer to the block
+   * @param offset the offset of the bytes
+   * @param size the number of bytes
+   */
+  static void LogUpdate(const size_t &block_id, Block *block,
+                        const size_t &offset, const size_t &size);
+
+  /**
+   * @brief log a snapshot of the metadata of a manager, it is written to the
+   * file of the manager if the log is replayed
+   *
+   * @param kind the manager
+   * @param snapshot the content of the file
+   */
+  static void LogMeta(const MetaKind &kind, std::string_view snapshot);
+
+  /**
+   * @brief end a statement: wait until its log records are on the disk,
+   * together with those of the other threads committing at the same time
+   * (only if they are large enough without the synchronous commit), and take
+   * a checkpoint if it is due without the flusher thread
+   */
+  static void Commit();
+
+  /**
+   * @brief set whether Commit waits for the log
+   *
+   * @param sync whether Commit waits for the log
+   */
+  static void SetSyncCommit(bool sync) { sync_commit_ = sync; }
+
+  /**
+   * @brief get the statistics of the log since startup
+   *
+   * @return the statistics
+   */
+  static LogStats LogStatistics() { return log_->Stats(); }
+
+  /**
+   * @brief verify the checksums of all the allocated pages on the disk, in
+   * parallel (CAUTION: nothing should be written meanwhile)
+   *
+   * @return the pages checked and the corrupted ones
+   */
+  static ScrubStats Scrub();
+
+  /**
+   * @brief give the trailing free blocks back to the file system
+   *
+   * @return the number of blocks truncated
+   */
+  static size_t Truncate();
+
+  /**
+   * @brief get the statistics of the free space
+   *
+   * @return the statistics
+   */
+  static FreeSpaceStats FreeSpace();
+
+  /**
+   * @brief get the hits and misses of each AccessClass since startup
+   *
+   * @return the statistics, indexed by AccessClass
+   */
+  static std::array<AccessStats, kAccessClassNum> HitStats();
+
+  /**
+   * @brief get the statistics of the write-back since startup
+   *
+   * @return the statistics
+   */
+  static FlushStats FlushStatistics();
 };
 
 extern BufferManager buffer_manager;
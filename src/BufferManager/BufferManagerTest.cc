@@ -1,17 +1,17 @@
 #include "BufferManager.hpp"
 
 void BufferManagerTest() {
-  auto a = new Block;
-  memset(a->val_, 0x3f, sizeof(a->val_));
-  const auto a_id = buffer_manager.Create(a);
-  a->pin_ = true;
-  a->dirty_ = true;
-  for (int i = 0; i < Config::kMaxBlockNum; i++) {
-    auto b = new Block;
-    buffer_manager.Create(b);
+  size_t a_id;
+  auto a = buffer_manager.Create(a_id);
+  memset(a->val_, 0x3f, Config::kBlockSize);
+  a->MarkDirty();
+  for (size_t i = 0; i < buffer_manager.BlockNum(); i++) {
+    size_t b_id;
+    buffer_manager.Create(b_id)->Unpin();
   }
-  a->pin_ = false;
-  auto b = new Block;
-  buffer_manager.Create(b);
+  a->Unpin();
+  size_t b_id;
+  buffer_manager.Create(b_id)->Unpin();
   auto c = buffer_manager.Read(a_id);
+  c->Unpin();
 }
@@ -0,0 +1,64 @@
+#include "FrameArena.hpp"
+
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+// every frame is aligned for O_DIRECT as long as the size of a page is
+static_assert(Config::kPageSize % Config::kDirectIOAlignment == 0);
+
+FrameArena::FrameArena(const size_t &block_num)
+    : block_num_(block_num), blocks_(std::make_unique<Block[]>(block_num)) {
+  const size_t size = (block_num * Config::kPageSize + kHugePageSize - 1) /
+                      kHugePageSize * kHugePageSize;
+  auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  char *base;
+  if (mapping != MAP_FAILED) {
+    huge_pages_ = true;
+    mapping_ = base = static_cast<char *>(mapping);
+    mapping_size_ = size;
+  } else {  // over-map by a huge page to align the frames by hand
+    mapping = mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+      throw std::system_error(errno, std::generic_category(), "mmap");
+    mapping_ = static_cast<char *>(mapping);
+    mapping_size_ = size + kHugePageSize;
+    base = reinterpret_cast<char *>(
+        (reinterpret_cast<uintptr_t>(mapping_) + kHugePageSize - 1) &
+        ~(kHugePageSize - 1));
+    madvise(base, size, MADV_HUGEPAGE);  // only a hint
+  }
+  frames_ = base;
+  free_.reserve(block_num);
+  for (size_t i = block_num; i-- > 0;) {  // hand out the low addresses first
+    blocks_[i].page_ = base + i * Config::kPageSize;
+    blocks_[i].val_ = blocks_[i].page_ + Config::kPageHeaderSize;
+    free_.push_back(&blocks_[i]);
+  }
+}
+
+FrameArena::~FrameArena() { munmap(mapping_, mapping_size_); }
+
+Block *FrameArena::Allocate() {
+  std::unique_lock lock(mutex_);
+  released_.wait(lock, [this] { return !free_.empty(); });
+  auto block = free_.back();
+  free_.pop_back();
+  block->ClearDirty();
+  block->pin_count_ = 0;
+  block->lsn_ = 0;
+  block->rec_lsn_ = 0;
+  return block;
+}
+
+void FrameArena::Release(Block *block) {
+  {
+    std::lock_guard lock(mutex_);
+    free_.push_back(block);
+  }
+  released_.notify_one();
+}
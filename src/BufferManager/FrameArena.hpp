@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "DataStructure.hpp"
+
+/**
+ * @brief the memory of the buffer: the frames of all the blocks are carved out
+ * of one mapping aligned to the 2 MiB huge pages, and the blocks are recycled
+ * instead of being allocated on every miss
+ */
+class FrameArena {
+  static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+  char *mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  char *frames_;  // the aligned beginning of the frames
+  bool huge_pages_ = false;  // backed by MAP_HUGETLB pages
+  size_t block_num_;
+  std::unique_ptr<Block[]> blocks_;
+
+  std::mutex mutex_;  // protects free_
+  std::condition_variable released_;
+  std::vector<Block *> free_;
+
+ public:
+  /**
+   * @brief map the frames, use the huge pages if there are enough of them,
+   * otherwise ask for transparent huge pages
+   *
+   * @param block_num the number of frames
+   */
+  explicit FrameArena(const size_t &block_num);
+  ~FrameArena();
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  /**
+   * @brief take an unused block, wait if every block is in use
+   *
+   * @return the block, unpinned and clean
+   */
+  Block *Allocate();
+
+  /**
+   * @brief give a block back to the arena
+   *
+   * @param block the block
+   */
+  void Release(Block *block);
+
+  size_t BlockNum() const { return block_num_; }
+  const char *Frames() const { return frames_; }
+  size_t FramesSize() const { return block_num_ * Config::kPageSize; }
+  bool HugePages() const { return huge_pages_; }
+};
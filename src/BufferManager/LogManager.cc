@@ -0,0 +1,400 @@
+#include "LogManager.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <system_error>
+
+void SyncFile(const string &filename) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return;  // nothing to sync
+  const bool synced = fsync(fd) == 0;
+  const auto error = errno;
+  close(fd);
+  if (!synced)
+    throw std::system_error(error, std::generic_category(),
+                            "fsync " + filename);
+}
+
+LogManager::LogManager(bool read_only) {
+  if (read_only) return;  // nothing is logged
+  // opened during the static initialization, before main creates it
+  std::error_code ec;
+  std::filesystem::create_directories(CommonPathPrefix, ec);
+  fd_ = open(Config::kLogFileName, O_RDWR | O_CREAT, 0644);
+  if (fd_ < 0)
+    throw std::system_error(errno, std::generic_category(),
+                            Config::kLogFileName);
+  uint64_t header[3];
+  if (pread(fd_, header, sizeof(header), 0) == sizeof(header) &&
+      header[0] == kMagic) {
+    existed_ = true;
+    base_lsn_ = end_lsn_ = durable_lsn_ = header[1];
+    checkpoint_size_ = header[2];
+  } else {
+    Reset();
+  }
+}
+
+LogManager::~LogManager() {
+  if (fd_ >= 0) close(fd_);
+}
+
+int LogManager::WriteAt(const char *data, size_t size, off_t offset) {
+  while (size > 0) {
+    const auto written = pwrite(fd_, data, size, offset);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    data += written;
+    size -= written;
+    offset += written;
+  }
+  return 0;
+}
+
+size_t LogManager::Decode(std::string_view log, const uint64_t &base_lsn,
+                          const std::function<void(const LogRecord &)> &apply,
+                          size_t &count) {
+  size_t pos = 0;
+  while (pos + kRecordHeaderSize <= log.size()) {
+    const char *record = log.data() + pos;
+    uint32_t checksum, size;
+    memcpy(&checksum, record, sizeof(checksum));
+    memcpy(&size, record + sizeof(checksum), sizeof(size));
+    if (size < kRecordHeaderSize || size > log.size() - pos ||
+        Crc32c(record + sizeof(checksum), size - sizeof(checksum)) != checksum)
+      break;  // torn by a crash
+    LogRecord entry{};
+    entry.type = static_cast<LogRecordType>(record[2 * sizeof(uint32_t)]);
+    entry.lsn = base_lsn + pos + size;
+    const char *body = record + kRecordHeaderSize;
+    const size_t body_size = size - kRecordHeaderSize;
+    bool valid = true;
+    switch (entry.type) {
+      case LogRecordType::Update: {
+        uint64_t block_id;
+        uint32_t len;
+        valid = body_size >= sizeof(block_id) + 2 * sizeof(uint32_t);
+        if (!valid) break;
+        memcpy(&block_id, body, sizeof(block_id));
+        memcpy(&entry.offset, body + sizeof(block_id), sizeof(entry.offset));
+        memcpy(&len, body + sizeof(block_id) + sizeof(entry.offset),
+               sizeof(len));
+        const auto head = sizeof(block_id) + 2 * sizeof(uint32_t);
+        valid = len == body_size - head &&
+                entry.offset + len <= static_cast<size_t>(Config::kBlockSize);
+        entry.block_id = block_id;
+        entry.data = std::string_view(body + head, len);
+        break;
+      }
+      case LogRecordType::Alloc: {
+        uint64_t block_id;
+        uint32_t page_type;
+        valid = body_size == sizeof(block_id) + sizeof(page_type);
+        if (!valid) break;
+        memcpy(&block_id, body, sizeof(block_id));
+        memcpy(&page_type, body + sizeof(block_id), sizeof(page_type));
+        entry.block_id = block_id;
+        entry.page_type = static_cast<PageType>(page_type);
+        break;
+      }
+      case LogRecordType::Free: {
+        uint64_t block_id;
+        valid = body_size == sizeof(block_id);
+        if (!valid) break;
+        memcpy(&block_id, body, sizeof(block_id));
+        entry.block_id = block_id;
+        break;
+      }
+      case LogRecordType::Meta:
+        valid = body_size >= sizeof(entry.kind);
+        if (!valid) break;
+        memcpy(&entry.kind, body, sizeof(entry.kind));
+        valid = entry.kind <= MetaKind::Index;
+        entry.data = std::string_view(body + sizeof(entry.kind),
+                                      body_size - sizeof(entry.kind));
+        break;
+      default:
+        valid = false;
+    }
+    if (!valid) break;
+    apply(entry);
+    pos += size;
+    count++;
+  }
+  return pos;
+}
+
+size_t LogManager::Replay(
+    const std::function<void(const LogRecord &)> &apply) {
+  struct stat st;
+  if (fstat(fd_, &st) < 0)
+    throw std::system_error(errno, std::generic_category(), "fstat the log");
+  string log(st.st_size > static_cast<off_t>(kFileHeaderSize)
+                 ? st.st_size - kFileHeaderSize
+                 : 0,
+             '\0');
+  for (size_t read = 0; read < log.size();) {
+    const auto ret = pread(fd_, log.data() + read, log.size() - read,
+                           kFileHeaderSize + read);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) {
+      log.resize(read);
+      break;
+    }
+    read += ret;
+  }
+
+  // the checkpoint record is written before the header points to it
+  size_t count = 0;
+  const std::string_view checkpoint(log.data(),
+                                    std::min(checkpoint_size_, log.size()));
+  if (Decode(checkpoint, base_lsn_, apply, count) != checkpoint_size_)
+    throw std::runtime_error("the checkpoint record of the log is corrupted");
+  const auto pos =
+      Decode(std::string_view(log).substr(checkpoint_size_), base_lsn_, apply,
+             count);
+
+  std::lock_guard lock(mutex_);
+  end_lsn_ = durable_lsn_ = base_lsn_ + pos;
+  // the torn tail would be in the way of the next records
+  if (ftruncate(fd_, kFileHeaderSize + checkpoint_size_ + pos) < 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "truncate the log");
+  return count;
+}
+
+void LogManager::Reset() {
+  std::unique_lock lock(mutex_);
+  flushed_.wait(lock, [this] { return !flushing_; });
+  buffer_.clear();
+  base_lsn_ = durable_lsn_ = end_lsn_;
+  checkpoint_size_ = 0;
+  for (size_t i = 0; i < kMetaKindNum; i++) {
+    meta_[i].clear();
+    has_meta_[i] = false;
+  }
+  const uint64_t header[] = {kMagic, base_lsn_, checkpoint_size_};
+  int error =
+      WriteAt(reinterpret_cast<const char *>(header), sizeof(header), 0);
+  if (!error && ftruncate(fd_, kFileHeaderSize) < 0) error = errno;
+  if (!error && fdatasync(fd_) < 0) error = errno;
+  if (error)
+    throw std::system_error(error, std::generic_category(), "reset the log");
+}
+
+string LogManager::Encode(const LogRecordType &type, const void *head,
+                          const size_t &head_size, std::string_view data) {
+  const uint32_t size = kRecordHeaderSize + head_size + data.size();
+  string record(size, '\0');
+  memcpy(record.data() + sizeof(uint32_t), &size, sizeof(size));
+  record[2 * sizeof(uint32_t)] = static_cast<char>(type);
+  memcpy(record.data() + kRecordHeaderSize, head, head_size);
+  if (!data.empty())
+    memcpy(record.data() + kRecordHeaderSize + head_size, data.data(),
+           data.size());
+  const uint32_t checksum =
+      Crc32c(record.data() + sizeof(uint32_t), size - sizeof(uint32_t));
+  memcpy(record.data(), &checksum, sizeof(checksum));
+  return record;
+}
+
+uint64_t LogManager::Append(const LogRecordType &type, const void *head,
+                            const size_t &head_size, std::string_view data,
+                            std::atomic<uint64_t> *rec_lsn) {
+  const auto record = Encode(type, head, head_size, data);
+
+  std::lock_guard lock(mutex_);
+  // under the lock, so a checkpoint sees it once its LSN is taken
+  if (rec_lsn && !*rec_lsn) *rec_lsn = end_lsn_;
+  buffer_ += record;
+  end_lsn_ += record.size();
+  stats_.records++;
+  stats_.bytes += record.size();
+  if (type == LogRecordType::Meta) {
+    MetaKind kind;
+    memcpy(&kind, head, sizeof(kind));
+    meta_[static_cast<size_t>(kind)] = data;
+    has_meta_[static_cast<size_t>(kind)] = true;
+  }
+  return end_lsn_;
+}
+
+uint64_t LogManager::LogUpdate(const size_t &block_id, const char *data,
+                               const size_t &offset, const size_t &size,
+                               std::atomic<uint64_t> &rec_lsn) {
+  char head[sizeof(uint64_t) + 2 * sizeof(uint32_t)];
+  const uint64_t id = block_id;
+  const uint32_t off = offset, len = size;
+  memcpy(head, &id, sizeof(id));
+  memcpy(head + sizeof(id), &off, sizeof(off));
+  memcpy(head + sizeof(id) + sizeof(off), &len, sizeof(len));
+  return Append(LogRecordType::Update, head, sizeof(head),
+                std::string_view(data, size), &rec_lsn);
+}
+
+uint64_t LogManager::LogAlloc(const size_t &block_id, const PageType &type,
+                              std::atomic<uint64_t> &rec_lsn) {
+  char head[sizeof(uint64_t) + sizeof(uint32_t)];
+  const uint64_t id = block_id;
+  const uint32_t page_type = static_cast<uint32_t>(type);
+  memcpy(head, &id, sizeof(id));
+  memcpy(head + sizeof(id), &page_type, sizeof(page_type));
+  return Append(LogRecordType::Alloc, head, sizeof(head), {}, &rec_lsn);
+}
+
+uint64_t LogManager::LogFree(const size_t &block_id) {
+  const uint64_t id = block_id;
+  return Append(LogRecordType::Free, &id, sizeof(id), {});
+}
+
+uint64_t LogManager::LogMeta(const MetaKind &kind, std::string_view snapshot) {
+  return Append(LogRecordType::Meta, &kind, sizeof(kind), snapshot);
+}
+
+void LogManager::Flush(const uint64_t &lsn) {
+  std::unique_lock lock(mutex_);
+  const auto target = std::min(lsn, end_lsn_);
+  while (durable_lsn_ < target) {
+    if (flushing_) {  // the records may be written by the current leader
+      flushed_.wait(lock);
+      continue;
+    }
+    // the leader writes everything appended so far for the whole group
+    flushing_ = true;
+    writing_.swap(buffer_);
+    const auto end_lsn = end_lsn_;
+    const off_t offset =
+        kFileHeaderSize + checkpoint_size_ + durable_lsn_ - base_lsn_;
+    lock.unlock();
+    int error = WriteAt(writing_.data(), writing_.size(), offset);
+    if (!error && fdatasync(fd_) < 0) error = errno;
+    lock.lock();
+    flushing_ = false;
+    if (error) {
+      buffer_.insert(0, writing_);
+      writing_.clear();
+      flushed_.notify_all();
+      throw std::system_error(error, std::generic_category(),
+                              "write the log");
+    }
+    writing_.clear();
+    durable_lsn_ = end_lsn;
+    stats_.syncs++;
+    flushed_.notify_all();
+  }
+}
+
+void LogManager::Checkpoint(uint64_t redo_lsn) {
+  std::unique_lock lock(mutex_);
+  flushed_.wait(lock, [this] { return !flushing_; });
+  // keeps the others from writing the file, they can still append
+  flushing_ = true;
+  redo_lsn = std::clamp(redo_lsn, base_lsn_, durable_lsn_);
+  // the snapshots match the records appended so far, which go into the new
+  // file together with them
+  string checkpoint;
+  for (size_t i = 0; i < kMetaKindNum; i++)
+    if (has_meta_[i]) {
+      const auto kind = static_cast<MetaKind>(i);
+      checkpoint += Encode(LogRecordType::Meta, &kind, sizeof(kind), meta_[i]);
+    }
+  string pending;
+  pending.swap(buffer_);
+  const auto end_lsn = end_lsn_, durable_lsn = durable_lsn_;
+  const off_t offset =
+      kFileHeaderSize + checkpoint_size_ + redo_lsn - base_lsn_;
+  lock.unlock();
+
+  const string tmp_name = string(Config::kLogFileName) + ".tmp";
+  const uint64_t header[] = {kMagic, redo_lsn, checkpoint.size()};
+  string file(reinterpret_cast<const char *>(header), sizeof(header));
+  file += checkpoint;
+  const auto tail = file.size();
+  file.resize(tail + durable_lsn - redo_lsn);
+  int error = 0;
+  for (size_t read = 0; !error && read < durable_lsn - redo_lsn;) {
+    const auto ret = pread(fd_, file.data() + tail + read,
+                           durable_lsn - redo_lsn - read, offset + read);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0)
+      error = ret < 0 ? errno : EIO;
+    else
+      read += ret;
+  }
+  file += pending;
+  int fd = -1;
+  if (!error) {
+    fd = open(tmp_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) error = errno;
+  }
+  if (!error) {
+    std::swap(fd, fd_);  // WriteAt writes fd_
+    error = WriteAt(file.data(), file.size(), 0);
+    std::swap(fd, fd_);
+  }
+  if (!error && fdatasync(fd) < 0) error = errno;
+  if (!error && rename(tmp_name.c_str(), Config::kLogFileName) < 0)
+    error = errno;
+  if (error) {
+    if (fd >= 0) {
+      close(fd);
+      unlink(tmp_name.c_str());
+    }
+    lock.lock();
+    buffer_.insert(0, pending);
+    flushing_ = false;
+    flushed_.notify_all();
+    throw std::system_error(error, std::generic_category(),
+                            "checkpoint the log");
+  }
+  // the new file is in place from now on, even if its directory entry can't
+  // be synced
+  std::exception_ptr sync_error;
+  try {
+    SyncFile(CommonPathPrefix);
+  } catch (const std::system_error &) {
+    sync_error = std::current_exception();
+  }
+  close(fd_);
+
+  lock.lock();
+  fd_ = fd;
+  base_lsn_ = redo_lsn;
+  checkpoint_size_ = checkpoint.size();
+  durable_lsn_ = end_lsn;
+  flushing_ = false;
+  stats_.syncs++;
+  stats_.checkpoints++;
+  flushed_.notify_all();
+  if (sync_error) std::rethrow_exception(sync_error);
+}
+
+uint64_t LogManager::EndLsn() {
+  std::lock_guard lock(mutex_);
+  return end_lsn_;
+}
+
+size_t LogManager::Size() {
+  std::lock_guard lock(mutex_);
+  return end_lsn_ - base_lsn_;
+}
+
+size_t LogManager::Pending() {
+  std::lock_guard lock(mutex_);
+  return buffer_.size();
+}
+
+LogStats LogManager::Stats() {
+  std::lock_guard lock(mutex_);
+  return stats_;
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "DataStructure.hpp"
+#include "Page.hpp"
+
+enum struct LogRecordType : uint8_t {
+  Update = 1,  // the new bytes of a part of a block
+  Alloc,       // a block is allocated and zeroed, with the type of its page
+  Free,        // a block is freed
+  Meta,        // a snapshot of the metadata of a manager
+};
+
+enum struct MetaKind : uint32_t { Catalog, Record, Index };
+constexpr size_t kMetaKindNum = 3;
+
+struct LogRecord {
+  LogRecordType type;
+  uint64_t lsn;           // the end of the record
+  size_t block_id;        // Update, Alloc and Free
+  uint32_t offset;        // Update
+  PageType page_type;     // Alloc
+  MetaKind kind;          // Meta
+  std::string_view data;  // Update: the bytes, Meta: the snapshot
+};
+
+struct LogStats {
+  size_t records;  // appended since startup
+  size_t bytes;    // appended since startup
+  size_t syncs;    // each of them makes a group of commits durable
+  size_t checkpoints;
+};
+
+/**
+ * @brief make a file written through a stream durable
+ *
+ * @param filename the name of the file
+ */
+void SyncFile(const string &filename);
+
+/**
+ * @brief the write-ahead log (Config::kLogFileName): every change to a block
+ * or to the metadata is appended to it before the change reaches the disk, so
+ * that the changes since the last clean shutdown can be replayed after a
+ * crash. A record is protected by a CRC32C, and a torn tail is ignored.
+ *
+ * The LSN of a record is the position of its end in the log, it keeps growing
+ * when the log is emptied. Appending only copies the record into memory, Flush
+ * writes the records with one fdatasync for all the threads waiting for it
+ * (group commit). Thread-safe.
+ *
+ * A checkpoint cuts off the records before an LSN, the latest snapshots of the
+ * metadata are kept in a checkpoint record between the file header and the
+ * remaining records, and are replayed first.
+ */
+class LogManager {
+  static constexpr uint64_t kMagic = 0x32474c4c51534d4d;  // "MMSQLLG2"
+  // magic, the LSN of the first record and the size of the checkpoint record
+  static constexpr size_t kFileHeaderSize = 3 * sizeof(uint64_t);
+  // checksum, size, type and padding, followed by the fixed part of the type
+  static constexpr size_t kRecordHeaderSize = 3 * sizeof(uint32_t);
+
+  int fd_ = -1;
+  bool existed_ = false;  // the log was there before this run
+
+  std::mutex mutex_;  // protects the members below
+  std::condition_variable flushed_;
+  string buffer_;                 // appended but not written yet
+  string writing_;                // being written by the flushing thread
+  uint64_t base_lsn_ = 0;         // the LSN of the first record in the file
+  uint64_t checkpoint_size_ = 0;  // the size of the checkpoint record
+  uint64_t end_lsn_ = 0;          // the end of the last appended record
+  uint64_t durable_lsn_ = 0;      // the end of the written records
+  bool flushing_ = false;  // a thread is writing writing_ or checkpointing
+  LogStats stats_{};
+  string meta_[kMetaKindNum];  // the latest snapshots since the last Reset
+  bool has_meta_[kMetaKindNum] = {};
+
+  /**
+   * @brief encode a record
+   *
+   * @param type the type of the record
+   * @param head the fixed part of the record after the header
+   * @param head_size the size of the fixed part
+   * @param data the variable part of the record
+   * @return the record
+   */
+  static string Encode(const LogRecordType &type, const void *head,
+                       const size_t &head_size, std::string_view data);
+
+  /**
+   * @brief decode the records in some bytes of the log, stop at the first one
+   * which is incomplete or corrupted
+   *
+   * @param log the bytes
+   * @param base_lsn the LSN of the beginning of the bytes
+   * @param apply called for each record
+   * @param count increased by the number of records
+   * @return the number of bytes in the good records
+   */
+  static size_t Decode(std::string_view log, const uint64_t &base_lsn,
+                       const std::function<void(const LogRecord &)> &apply,
+                       size_t &count);
+
+  /**
+   * @brief append a record
+   *
+   * @param type the type of the record
+   * @param head the fixed part of the record after the header
+   * @param head_size the size of the fixed part
+   * @param data the variable part of the record
+   * @param rec_lsn set to the LSN before the record if it is 0
+   * @return the LSN of the record
+   */
+  uint64_t Append(const LogRecordType &type, const void *head,
+                  const size_t &head_size, std::string_view data,
+                  std::atomic<uint64_t> *rec_lsn = nullptr);
+
+  /**
+   * @brief write some bytes to the log
+   *
+   * @param data the bytes
+   * @param size the number of bytes
+   * @param offset the offset in the file
+   * @return 0, or the errno of the failure
+   */
+  int WriteAt(const char *data, size_t size, off_t offset);
+
+ public:
+  /**
+   * @brief open the log, create it if it doesn't exist
+   *
+   * @param read_only leave the log alone: it isn't opened, and stays empty
+   */
+  explicit LogManager(bool read_only = false);
+  ~LogManager();
+  LogManager(const LogManager &) = delete;
+  LogManager &operator=(const LogManager &) = delete;
+
+  /**
+   * @brief whether the log was there before this run, i.e. the blocks and
+   * the metadata on the disk can be brought up to date by Replay
+   */
+  bool Existed() const { return existed_; }
+
+  /**
+   * @brief read the records in the order they were appended, stop at the
+   * first one which is incomplete or corrupted, the records are appended after
+   * the last good one later (CAUTION: should be called before anything is
+   * appended)
+   *
+   * @param apply called for each record
+   * @return the number of records
+   */
+  size_t Replay(const std::function<void(const LogRecord &)> &apply);
+
+  /**
+   * @brief drop all the records, the LSN goes on from the last one (CAUTION:
+   * their changes should be durable)
+   */
+  void Reset();
+
+  /**
+   * @brief log the new bytes of a part of a block
+   *
+   * @param block_id the id of the block
+   * @param data the bytes
+   * @param offset the offset of the bytes in the block
+   * @param size the number of bytes
+   * @param rec_lsn Block::rec_lsn_ of the block, set before the record is
+   * appended if the block has been written back since its last change
+   * @return the LSN of the record
+   */
+  uint64_t LogUpdate(const size_t &block_id, const char *data,
+                     const size_t &offset, const size_t &size,
+                     std::atomic<uint64_t> &rec_lsn);
+
+  uint64_t LogAlloc(const size_t &block_id, const PageType &type,
+                    std::atomic<uint64_t> &rec_lsn);
+  uint64_t LogFree(const size_t &block_id);
+
+  /**
+   * @brief log a snapshot of the metadata of a manager, it replaces the
+   * previous one
+   *
+   * @param kind the manager
+   * @param snapshot the metadata as it is written to its file
+   * @return the LSN of the record
+   */
+  uint64_t LogMeta(const MetaKind &kind, std::string_view snapshot);
+
+  /**
+   * @brief make the records up to an LSN durable, the threads which call it
+   * at the same time share one write
+   *
+   * @param lsn the LSN
+   */
+  void Flush(const uint64_t &lsn);
+
+  /**
+   * @brief drop the records before an LSN, the records after it and the
+   * latest snapshots of the metadata are moved into a new file (CAUTION: the
+   * changes of the dropped records to the blocks should be durable)
+   *
+   * @param redo_lsn the LSN, it only goes as far as the written records
+   */
+  void Checkpoint(uint64_t redo_lsn);
+
+  /**
+   * @brief get the LSN of the last record
+   */
+  uint64_t EndLsn();
+
+  /**
+   * @brief get the number of bytes which would be replayed after a crash
+   */
+  size_t Size();
+
+  /**
+   * @brief get the number of bytes appended but not written yet
+   */
+  size_t Pending();
+
+  LogStats Stats();
+};
@@ -0,0 +1,46 @@
+#include "Page.hpp"
+
+#include <nmmintrin.h>
+
+#include <algorithm>
+#include <cstring>
+
+uint32_t Crc32c(const void *data, size_t size, uint32_t crc) {
+  auto bytes = static_cast<const unsigned char *>(data);
+  uint64_t crc64 = ~crc;
+  for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    bytes += sizeof(word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+  for (; size > 0; size--) crc = _mm_crc32_u8(crc, *bytes++);
+  return ~crc;
+}
+
+/**
+ * @brief compute the checksum of a page, which covers everything after it
+ */
+static uint32_t PageChecksum(const char *page) {
+  constexpr auto kSkipped = sizeof(PageHeader::checksum);
+  return Crc32c(page + kSkipped, Config::kPageSize - kSkipped);
+}
+
+void InitPage(char *page, const PageType &type) {
+  memset(page, 0, Config::kPageSize);
+  HeaderOf(page).type = type;
+}
+
+void SealPage(char *page, const uint64_t &lsn) {
+  auto &header = HeaderOf(page);
+  header.lsn = lsn;
+  header.checksum = PageChecksum(page);
+}
+
+bool VerifyPage(const char *page) {
+  if (HeaderOf(page).checksum == PageChecksum(page)) return true;
+  // a hole, or past the end of the file
+  return std::all_of(page, page + Config::kPageSize,
+                     [](const char &byte) { return byte == 0; });
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "DataStructure.hpp"
+
+/**
+ * @brief what a page holds, kept in its header
+ */
+enum struct PageType : uint16_t {
+  Empty = 0,  // never written, reads as zeros
+  Record,
+  Index,
+  Other,
+};
+
+/**
+ * @brief the first Config::kPageHeaderSize bytes of every page on the disk,
+ * followed by the Config::kBlockSize bytes of Block::val_
+ */
+struct PageHeader {
+  uint32_t checksum;  // CRC32C of the rest of the page
+  PageType type;
+  uint16_t reserved;
+  uint64_t lsn;  // the LSN of the last log record of the page when written
+};
+static_assert(sizeof(PageHeader) == Config::kPageHeaderSize);
+
+/**
+ * @brief compute the CRC32C (Castagnoli) of some bytes with SSE4.2
+ *
+ * @param data the bytes
+ * @param size the number of bytes
+ * @param crc the CRC32C of the bytes before them
+ * @return the CRC32C
+ */
+uint32_t Crc32c(const void *data, size_t size, uint32_t crc = 0);
+
+/**
+ * @brief zero a page and set its type
+ *
+ * @param page Config::kPageSize bytes
+ * @param type the type of the page
+ */
+void InitPage(char *page, const PageType &type);
+
+/**
+ * @brief fill in the LSN and the checksum of a page before it is written
+ *
+ * @param page Config::kPageSize bytes
+ * @param lsn the LSN of the last log record of the page
+ */
+void SealPage(char *page, const uint64_t &lsn);
+
+/**
+ * @brief check the checksum of a page which has been read, a page which has
+ * never been written is all zeros and passes as well
+ *
+ * @param page Config::kPageSize bytes
+ * @return whether the page is intact
+ */
+bool VerifyPage(const char *page);
+
+/**
+ * @brief get the header of a page
+ *
+ * @param page Config::kPageSize bytes
+ * @return the header
+ */
+inline PageHeader &HeaderOf(char *page) {
+  return *reinterpret_cast<PageHeader *>(page);
+}
+inline const PageHeader &HeaderOf(const char *page) {
+  return *reinterpret_cast<const PageHeader *>(page);
+}
+
+/**
+ * @brief make the error thrown when a page fails the verification
+ *
+ * @param block_id the id of the block in the page
+ * @return the error
+ */
+inline corrupt_page_error CorruptPage(const size_t &block_id) {
+  return corrupt_page_error("page " + std::to_string(block_id) +
+                            " is corrupted");
+}
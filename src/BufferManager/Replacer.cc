@@ -0,0 +1,118 @@
+#include "Replacer.hpp"
+
+static bool IsEvictable(const BufferFrame *frame, bool clean_only) {
+  return frame->block->pin_count_.load(std::memory_order_acquire) == 0 &&
+         !frame->flushing.load(std::memory_order_acquire) &&
+         !(clean_only && frame->block->IsDirty());
+}
+
+void LRUReplacer::Insert(BufferFrame *frame) {
+  frame->referenced = false;
+  list_.PushFront(frame);
+  ++size_;
+}
+
+void LRUReplacer::Access(BufferFrame *frame) {
+  frame->referenced.store(true, std::memory_order_relaxed);
+}
+
+void LRUReplacer::Erase(BufferFrame *frame) {
+  FrameList::Unlink(frame);
+  --size_;
+}
+
+BufferFrame *LRUReplacer::Victim(bool clean_only) {
+  // every frame is promoted at most once, so 2 * size_ steps reach them all
+  auto frame = list_.Back();
+  for (size_t i = 0; i < 2 * size_ && frame != list_.End(); i++) {
+    const auto prev = frame->prev;
+    if (frame->referenced.exchange(false, std::memory_order_relaxed)) {
+      FrameList::Unlink(frame);
+      list_.PushFront(frame);
+    } else if (IsEvictable(frame, clean_only)) {
+      return frame;
+    }
+    frame = prev;
+  }
+  return nullptr;
+}
+
+BufferFrame *ClockReplacer::Advance(BufferFrame *frame) {
+  frame = frame->next;
+  if (frame == ring_.End()) frame = frame->next;
+  return frame;
+}
+
+void ClockReplacer::Insert(BufferFrame *frame) {
+  frame->referenced = false;
+  if (hand_ == nullptr) {
+    ring_.PushFront(frame);
+    hand_ = frame;
+  } else {  // link it right behind the hand so that it is examined last
+    frame->next = hand_;
+    frame->prev = hand_->prev;
+    hand_->prev->next = frame;
+    hand_->prev = frame;
+  }
+  ++size_;
+}
+
+void ClockReplacer::Access(BufferFrame *frame) {
+  frame->referenced.store(true, std::memory_order_relaxed);
+}
+
+void ClockReplacer::Erase(BufferFrame *frame) {
+  if (--size_ == 0)
+    hand_ = nullptr;
+  else if (hand_ == frame)
+    hand_ = Advance(frame);
+  FrameList::Unlink(frame);
+}
+
+BufferFrame *ClockReplacer::Victim(bool clean_only) {
+  // two sweeps clear every reference bit, so a third one can't find anything
+  for (size_t i = 0; i < 2 * size_; i++, hand_ = Advance(hand_)) {
+    if (!IsEvictable(hand_, clean_only)) continue;
+    if (!hand_->referenced.exchange(false, std::memory_order_relaxed))
+      return hand_;
+  }
+  return nullptr;
+}
+
+void ScanResistantReplacer::InsertScan(BufferFrame *frame) {
+  frame->referenced = false;
+  frame->scan = true;
+  scan_.PushFront(frame);
+}
+
+void ScanResistantReplacer::Access(BufferFrame *frame) {
+  if (frame->scan)
+    frame->referenced.store(true, std::memory_order_relaxed);
+  else
+    main_->Access(frame);
+}
+
+void ScanResistantReplacer::Erase(BufferFrame *frame) {
+  if (frame->scan) {
+    FrameList::Unlink(frame);
+    frame->scan = false;
+  } else {
+    main_->Erase(frame);
+  }
+}
+
+BufferFrame *ScanResistantReplacer::Victim(bool clean_only) {
+  auto frame = scan_.Back();
+  while (frame != scan_.End()) {
+    const auto prev = frame->prev;
+    if (frame->referenced.load(std::memory_order_relaxed)) {
+      FrameList::Unlink(frame);
+      frame->scan = false;
+      main_->Insert(frame);
+    } else if (IsEvictable(frame, clean_only)) {
+      return frame;
+    }
+    frame = prev;
+  }
+  return main_->Victim(clean_only);
+}
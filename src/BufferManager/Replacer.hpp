@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "DataStructure.hpp"
+
+struct BufferFrame {
+  size_t block_id;
+  Block *block;
+  BufferFrame *prev = nullptr, *next = nullptr;  // owned by the replacer
+  std::atomic<bool> referenced = false;  // set by hits, cleared by Victim
+  std::atomic<bool> loading = false;     // block->latch_ is held by the loader
+  std::atomic<bool> flushing = false;    // being written back by the flusher
+  // its page failed to load or to pass the verification, Read throws
+  std::atomic<bool> corrupt = false;
+  bool scan = false;  // inserted by InsertScan and not promoted since
+};
+
+/**
+ * @brief the replacement policy of a buffer shard. All the operations are
+ * O(1) except Victim, which only skips busy or recently referenced frames.
+ * Access is called under the shared latch of the shard, so it may only touch
+ * the atomics of the frame; the others are called under the exclusive latch.
+ */
+class Replacer {
+ public:
+  virtual ~Replacer() = default;
+
+  /**
+   * @brief start tracking a frame which has just been added into the buffer
+   *
+   * @param frame the frame
+   */
+  virtual void Insert(BufferFrame *frame) = 0;
+
+  /**
+   * @brief start tracking a frame which has just been brought in by a
+   * sequential scan, it is unlikely to be used again soon
+   *
+   * @param frame the frame
+   */
+  virtual void InsertScan(BufferFrame *frame) { Insert(frame); }
+
+  /**
+   * @brief record a hit on a frame
+   *
+   * @param frame the frame
+   */
+  virtual void Access(BufferFrame *frame) = 0;
+
+  /**
+   * @brief stop tracking a frame
+   *
+   * @param frame the frame
+   */
+  virtual void Erase(BufferFrame *frame) = 0;
+
+  /**
+   * @brief choose a frame to be swapped out (it is still being tracked), a
+   * frame is never chosen while it is pinned or being written back
+   *
+   * @param clean_only whether to skip the dirty frames as well
+   * @return the frame, nullptr if there is no such frame
+   */
+  virtual BufferFrame *Victim(bool clean_only) = 0;
+};
+
+/**
+ * @brief doubly linked list threaded through the frames, head_ is a sentinel
+ */
+class FrameList {
+  BufferFrame head_;
+
+ public:
+  FrameList() { head_.prev = head_.next = &head_; }
+  bool Empty() const { return head_.next == &head_; }
+  BufferFrame *Front() { return head_.next; }
+  BufferFrame *Back() { return head_.prev; }
+  const BufferFrame *End() const { return &head_; }
+  void PushFront(BufferFrame *frame) {
+    frame->prev = &head_;
+    frame->next = head_.next;
+    head_.next->prev = frame;
+    head_.next = frame;
+  }
+  static void Unlink(BufferFrame *frame) {
+    frame->prev->next = frame->next;
+    frame->next->prev = frame->prev;
+    frame->prev = frame->next = nullptr;
+  }
+};
+
+/**
+ * @brief LRU with lazy promotion: a hit only sets the reference bit, and the
+ * frame is moved to the front when Victim reaches it
+ */
+class LRUReplacer : public Replacer {
+  FrameList list_;  // front: most recently used
+  size_t size_ = 0;
+
+ public:
+  void Insert(BufferFrame *frame) override;
+  void Access(BufferFrame *frame) override;
+  void Erase(BufferFrame *frame) override;
+  BufferFrame *Victim(bool clean_only) override;
+};
+
+class ClockReplacer : public Replacer {
+  FrameList ring_;  // the sentinel is skipped by the hand
+  BufferFrame *hand_ = nullptr;
+  size_t size_ = 0;
+
+  BufferFrame *Advance(BufferFrame *frame);
+
+ public:
+  void Insert(BufferFrame *frame) override;
+  void Access(BufferFrame *frame) override;
+  void Erase(BufferFrame *frame) override;
+  BufferFrame *Victim(bool clean_only) override;
+};
+
+/**
+ * @brief keeps the frames brought in by sequential scans in a FIFO of their
+ * own, which is searched for a victim before the main policy, so that a large
+ * scan recycles its own frames instead of flushing the working set. A scanned
+ * frame that gets a hit is moved to the main policy when Victim reaches it.
+ */
+class ScanResistantReplacer : public Replacer {
+  FrameList scan_;  // front: the newest
+  std::unique_ptr<Replacer> main_;
+
+ public:
+  explicit ScanResistantReplacer(std::unique_ptr<Replacer> main)
+      : main_(std::move(main)) {}
+  void Insert(BufferFrame *frame) override { main_->Insert(frame); }
+  void InsertScan(BufferFrame *frame) override;
+  void Access(BufferFrame *frame) override;
+  void Erase(BufferFrame *frame) override;
+  BufferFrame *Victim(bool clean_only) override;
+};
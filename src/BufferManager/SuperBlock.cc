@@ -0,0 +1,102 @@
+#include "SuperBlock.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <fstream>
+
+bool SuperBlock::Load(bool &clean) {
+  std::ifstream is(Config::kSuperBlockFileName,
+                   std::ios::binary | std::ios::ate);
+  if (!is) return false;
+  const size_t size = is.tellg();
+  if (size < 3 * sizeof(uint64_t) || size % sizeof(uint64_t)) return false;
+  std::vector<uint64_t> buf(size / sizeof(uint64_t));
+  is.seekg(0);
+  if (!is.read(reinterpret_cast<char *>(buf.data()), size)) return false;
+  const auto &[magic, saved_clean, block_count] =
+      std::tie(buf[0], buf[1], buf[2]);
+  if (magic != kMagic || buf.size() - 3 != (block_count + 63) / 64)
+    return false;
+  clean = saved_clean;
+  block_count_ = block_count;
+  free_.assign(buf.begin() + 3, buf.end());
+  free_count_ = 0;
+  for (const auto &word : free_) free_count_ += std::popcount(word);
+  first_free_word_ = 0;
+  return true;
+}
+
+void SuperBlock::Save(bool clean) const {
+  std::ofstream os(Config::kSuperBlockFileName, std::ios::binary);
+  const uint64_t header[] = {kMagic, clean, block_count_};
+  os.write(reinterpret_cast<const char *>(header), sizeof(header));
+  os.write(reinterpret_cast<const char *>(free_.data()),
+           free_.size() * sizeof(uint64_t));
+}
+
+void SuperBlock::Reset(const size_t &block_count) {
+  block_count_ = block_count;
+  free_.assign((block_count + 63) / 64, 0);
+  free_count_ = 0;
+  first_free_word_ = 0;
+}
+
+size_t SuperBlock::NextId() {
+  if (free_count_ == 0) return block_count_;
+  while (free_[first_free_word_] == 0) first_free_word_++;
+  return first_free_word_ * 64 + std::countr_zero(free_[first_free_word_]);
+}
+
+size_t SuperBlock::Allocate() {
+  const auto block_id = NextId();
+  if (block_id == block_count_) {
+    if (block_count_++ % 64 == 0) free_.push_back(0);
+  } else {
+    free_[block_id / 64] &= ~(uint64_t{1} << (block_id % 64));
+    free_count_--;
+    stats_.reused_blocks++;
+  }
+  return block_id;
+}
+
+void SuperBlock::Take(const size_t &block_id) {
+  while (block_count_ <= block_id) {
+    if (block_count_ % 64 == 0) free_.push_back(0);
+    free_[block_count_ / 64] |= uint64_t{1} << (block_count_ % 64);
+    free_count_++;
+    first_free_word_ = std::min(first_free_word_, block_count_ / 64);
+    block_count_++;
+  }
+  if (!IsFree(block_id)) return;
+  free_[block_id / 64] &= ~(uint64_t{1} << (block_id % 64));
+  free_count_--;
+}
+
+void SuperBlock::Free(const size_t &block_id) {
+  if (block_id >= block_count_ || IsFree(block_id)) return;
+  free_[block_id / 64] |= uint64_t{1} << (block_id % 64);
+  free_count_++;
+  if (block_id / 64 < first_free_word_) first_free_word_ = block_id / 64;
+  stats_.freed_blocks++;
+}
+
+size_t SuperBlock::Truncate() {
+  const auto old_block_count = block_count_;
+  while (block_count_ > 0 && IsFree(block_count_ - 1)) {
+    block_count_--;
+    free_[block_count_ / 64] &= ~(uint64_t{1} << (block_count_ % 64));
+    free_count_--;
+  }
+  free_.resize((block_count_ + 63) / 64);
+  if (first_free_word_ > free_.size()) first_free_word_ = free_.size();
+  stats_.truncated_blocks += old_block_count - block_count_;
+  return old_block_count - block_count_;
+}
+
+FreeSpaceStats SuperBlock::Stats() const {
+  auto stats = stats_;
+  stats.block_count = block_count_;
+  stats.free_blocks = free_count_;
+  stats.reclaimed_bytes = stats.freed_blocks * Config::kPageSize;
+  return stats;
+}
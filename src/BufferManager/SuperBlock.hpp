@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DataStructure.hpp"
+
+struct FreeSpaceStats {
+  size_t block_count;  // the high-water mark
+  size_t free_blocks;  // the freed ids below the high-water mark
+  // since startup
+  size_t freed_blocks;      // given back by dropped tables and indexes
+  size_t reused_blocks;     // allocated from the freed ids
+  size_t truncated_blocks;  // cut off the end of the block store
+  size_t reclaimed_bytes;   // disk space released by the freed blocks
+};
+
+/**
+ * @brief the free-space manager: the high-water mark of the block ids and a
+ * bitmap of the freed ids below it, persisted in Config::kSuperBlockFileName
+ */
+class SuperBlock {
+  static constexpr uint64_t kMagic = 0x4b4c425245505553;  // "SUPERBLK"
+
+  size_t block_count_ = 0;
+  size_t free_count_ = 0;
+  size_t first_free_word_ = 0;  // no free id in the words before it
+  std::vector<uint64_t> free_;
+  FreeSpaceStats stats_{};
+
+ public:
+  /**
+   * @brief load the superblock with a single read
+   *
+   * @param clean set to whether the last run shut down cleanly, otherwise the
+   * superblock falls behind the blocks by the changes in the log
+   * @return false if there is no usable superblock
+   */
+  bool Load(bool &clean);
+
+  /**
+   * @brief write the superblock back to the file
+   *
+   * @param clean whether the blocks on the disk match the superblock
+   */
+  void Save(bool clean) const;
+
+  /**
+   * @brief forget the free ids and assume the ids below block_count are used
+   *
+   * @param block_count the high-water mark
+   */
+  void Reset(const size_t &block_count);
+
+  /**
+   * @brief get the high-water mark
+   */
+  size_t BlockCount() const { return block_count_; }
+
+  /**
+   * @brief get the number of the freed ids
+   */
+  size_t FreeCount() const { return free_count_; }
+
+  /**
+   * @brief get the id that the next Allocate() returns, i.e. the smallest
+   * freed id or the high-water mark
+   */
+  size_t NextId();
+
+  /**
+   * @brief take the id returned by NextId()
+   *
+   * @return the id
+   */
+  size_t Allocate();
+
+  /**
+   * @brief take a given id, the ids skipped over by raising the high-water
+   * mark are free
+   *
+   * @param block_id the id
+   */
+  void Take(const size_t &block_id);
+
+  /**
+   * @brief give an id back so that it can be allocated again
+   *
+   * @param block_id the id
+   */
+  void Free(const size_t &block_id);
+
+  /**
+   * @brief lower the high-water mark below the trailing free ids
+   *
+   * @return the number of ids cut off
+   */
+  size_t Truncate();
+
+  /**
+   * @brief get the statistics of the free space
+   */
+  FreeSpaceStats Stats() const;
+
+  /**
+   * @brief check whether an id has been freed
+   *
+   * @param block_id the id
+   */
+  bool IsFree(const size_t &block_id) const {
+    return block_id < block_count_ &&
+           (free_[block_id / 64] >> (block_id % 64) & 1);
+  }
+};
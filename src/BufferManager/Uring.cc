@@ -0,0 +1,152 @@
+#include "Uring.hpp"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+static void ThrowErrno(const char *what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+static int Setup(const unsigned &entries, io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int Enter(const int &fd, const unsigned &to_submit,
+                 const unsigned &min_complete, const unsigned &flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 nullptr, 0);
+}
+
+static int RegisterBuffers(const int &fd, const unsigned &opcode,
+                           const void *arg, const unsigned &nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+template <typename T>
+static T *At(void *ring, const unsigned &offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+Uring::Uring(const unsigned &entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  fd_ = Setup(entries, &params);
+  if (fd_ < 0) ThrowErrno("io_uring_setup");
+  entries_ = params.sq_entries;
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap)
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    close(fd_);
+    ThrowErrno("mmap the submission queue");
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      munmap(sq_ring_, sq_ring_size_);
+      close(fd_);
+      ThrowErrno("mmap the completion queue");
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  auto sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    if (cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+    munmap(sq_ring_, sq_ring_size_);
+    close(fd_);
+    ThrowErrno("mmap the submission queue entries");
+  }
+  sqes_ = static_cast<io_uring_sqe *>(sqes);
+  sq_head_ = At<unsigned>(sq_ring_, params.sq_off.head);
+  sq_tail_ = At<unsigned>(sq_ring_, params.sq_off.tail);
+  sq_mask_ = At<unsigned>(sq_ring_, params.sq_off.ring_mask);
+  sq_array_ = At<unsigned>(sq_ring_, params.sq_off.array);
+  cq_head_ = At<unsigned>(cq_ring_, params.cq_off.head);
+  cq_tail_ = At<unsigned>(cq_ring_, params.cq_off.tail);
+  cq_mask_ = At<unsigned>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = At<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+}
+
+Uring::~Uring() {
+  munmap(sqes_, sqes_size_);
+  if (cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+  munmap(sq_ring_, sq_ring_size_);
+  close(fd_);  // the registered buffer goes with the ring
+}
+
+bool Uring::Register(const char *base, const size_t &size) {
+  std::lock_guard lock(mutex_);
+  if (registered_) {
+    RegisterBuffers(fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+    registered_ = nullptr;
+  }
+  const iovec iov = {const_cast<char *>(base), size};
+  if (RegisterBuffers(fd_, IORING_REGISTER_BUFFERS, &iov, 1) < 0) return false;
+  registered_ = base;
+  registered_size_ = size;
+  return true;
+}
+
+void Uring::SubmitAndWait(UringRequest *requests, const unsigned &count) {
+  auto tail = *sq_tail_;
+  for (unsigned i = 0; i < count; i++, tail++) {
+    const auto &request = requests[i];
+    const auto index = tail & *sq_mask_;
+    auto &sqe = sqes_[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.fd = request.fd;
+    sqe.off = request.offset;
+    sqe.user_data = i;
+    const auto buf = static_cast<const char *>(request.iov[0].iov_base);
+    if (request.iov.size() == 1 && registered_ && buf >= registered_ &&
+        buf + request.iov[0].iov_len <= registered_ + registered_size_) {
+      sqe.opcode = request.write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+      sqe.addr = reinterpret_cast<uintptr_t>(buf);
+      sqe.len = request.iov[0].iov_len;
+      sqe.buf_index = 0;
+    } else {
+      sqe.opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+      sqe.addr = reinterpret_cast<uintptr_t>(request.iov.data());
+      sqe.len = request.iov.size();
+    }
+    sq_array_[index] = index;
+  }
+  __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+  unsigned submitted = 0, completed = 0;
+  while (completed < count) {
+    const auto ret = Enter(fd_, count - submitted, 1, IORING_ENTER_GETEVENTS);
+    if (ret < 0 && errno != EINTR) ThrowErrno("io_uring_enter");
+    if (ret > 0) submitted += ret;
+    auto head = *cq_head_;
+    for (; head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE); head++) {
+      const auto &cqe = cqes_[head & *cq_mask_];
+      requests[cqe.user_data].result = cqe.res;
+      completed++;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+}
+
+void Uring::Submit(std::vector<UringRequest> &requests) {
+  std::lock_guard lock(mutex_);
+  // the completion queue is twice as large, so a chunk never overflows it
+  for (size_t i = 0; i < requests.size(); i += entries_)
+    SubmitAndWait(requests.data() + i,
+                  std::min<size_t>(entries_, requests.size() - i));
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief a request of Uring::Submit, a single iovec inside the registered
+ * buffer is submitted as a fixed read/write
+ */
+struct UringRequest {
+  bool write;
+  int fd;
+  off_t offset;
+  std::vector<iovec> iov;
+  ssize_t result;  // the number of bytes transferred, or -errno
+};
+
+/**
+ * @brief a minimal io_uring driven by the raw system calls (no liburing), the
+ * requests of one Submit are in flight together, so a batch keeps the device
+ * busy instead of waiting for the blocks one by one
+ */
+class Uring {
+  int fd_ = -1;
+  unsigned entries_;
+  void *sq_ring_ = nullptr, *cq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0, cq_ring_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+  unsigned *cq_head_, *cq_tail_, *cq_mask_;
+  io_uring_cqe *cqes_;
+
+  std::mutex mutex_;  // a ring is driven by one thread at a time
+  const char *registered_ = nullptr;  // the registered buffer
+  size_t registered_size_ = 0;
+
+  /**
+   * @brief submit some requests and wait for all of them
+   *
+   * @param requests the requests, at most entries_ of them
+   */
+  void SubmitAndWait(UringRequest *requests, const unsigned &count);
+
+ public:
+  /**
+   * @brief set up a ring
+   *
+   * @param entries the size of the submission queue
+   * @throw std::system_error if io_uring isn't available
+   */
+  explicit Uring(const unsigned &entries);
+  ~Uring();
+  Uring(const Uring &) = delete;
+  Uring &operator=(const Uring &) = delete;
+
+  /**
+   * @brief register a buffer, so that the kernel doesn't map its pages on
+   * every request (it only replaces the previous one)
+   *
+   * @param base the beginning of the buffer
+   * @param size the size of the buffer
+   * @return whether it is registered, it fails under a low RLIMIT_MEMLOCK
+   */
+  bool Register(const char *base, const size_t &size);
+
+  /**
+   * @brief submit the requests and wait for all of them, a request which is
+   * interrupted is reported as -EINTR instead of being retried
+   *
+   * @param requests the requests
+   */
+  void Submit(std::vector<UringRequest> &requests);
+};
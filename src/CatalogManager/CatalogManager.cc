@@ -3,7 +3,9 @@
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
+#include "BufferManager.hpp"
 #include "DataStructure.hpp"
 
 CatalogManager::CatalogManager() {
@@ -14,25 +16,42 @@ CatalogManager::CatalogManager() {
               << std::endl;
     return;
   }
-  size_t size;
+  uint64_t magic = 0;  // an empty file has no tables
+  os.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+  // otherwise it was the number of tables
+  const bool has_layout = magic == kMagic;
+  size_t size = magic;
+  if (has_layout) os.read(reinterpret_cast<char *>(&size), sizeof(size));
   Table table;
-  os.read(reinterpret_cast<char *>(&size), sizeof(size));
   while (size--) {
-    table.read(os);
+    table.read(os, has_layout);
     tables_[table.table_name] = table;
   }
 }
 
 CatalogManager::~CatalogManager() {
+  if (BufferManager::ReadOnly()) return;  // the files are left as they were
   std::ofstream os(Config::kCatalogFileName, std::ios::binary);
+  Save(os);
+}
+
+void CatalogManager::Save(std::ostream &os) const {
+  os.write(reinterpret_cast<const char *>(&kMagic), sizeof(kMagic));
   const auto size = tables_.size();
   os.write(reinterpret_cast<const char *>(&size), sizeof(size));
   for (const auto &table : tables_) table.second.write(os);
 }
 
+void CatalogManager::LogSnapshot() const {
+  std::ostringstream os;
+  Save(os);
+  BufferManager::LogMeta(MetaKind::Catalog, os.view());
+}
+
 void CatalogManager::CreateTable(
     const string &table_name,
-    const vector<tuple<string, SqlValueType, SpecialAttribute>> &attributes) {
+    const vector<tuple<string, SqlValueType, SpecialAttribute>> &attributes,
+    const TableLayout &layout) {
   if (tables_.contains(table_name)) {
     std::cerr << "such a table already exists" << std::endl;
     throw invalid_ident("table duplicate");
@@ -40,6 +59,7 @@ void CatalogManager::CreateTable(
   size_t index = 0, offset = 0;
   Table table;
   table.table_name = table_name;
+  table.layout = layout;
   for (const auto &[attribute_name, type, special_attribute] : attributes) {
     table.attributes[attribute_name] =
         std::make_tuple(index++, type, special_attribute, offset);
@@ -57,6 +77,7 @@ void CatalogManager::CreateTable(
       table.indexes[attribute_name] = attribute_name;
   }
   tables_[table_name] = table;
+  LogSnapshot();
 }
 
 void CatalogManager::CreateIndex(const string &table_name,
@@ -75,11 +96,6 @@ void CatalogManager::CreateIndex(const string &table_name,
     std::cerr << "the attribute already has an index" << std::endl;
     throw invalid_ident("index duplicate");
   }
-  if (std::get<2>(table.attributes[attribute_name]) !=
-      SpecialAttribute::UniqueKey) {
-    std::cerr << "the attribute is not unique" << std::endl;
-    throw invalid_index_attribute("attribute not unique");
-  }
   for (const auto &index : table.indexes) {
     if (index.second == index_name) {
       std::cerr << "such an index name already exists" << std::endl;
@@ -87,6 +103,7 @@ void CatalogManager::CreateIndex(const string &table_name,
     }
   }
   table.indexes[attribute_name] = index_name;
+  LogSnapshot();
 }
 
 void CatalogManager::DropIndex(const string &table_name,
@@ -104,6 +121,7 @@ void CatalogManager::DropIndex(const string &table_name,
         throw invalid_ident("drop primary key index");
       }
       table.indexes.erase(index.first);
+      LogSnapshot();
       return;
     }
   }
@@ -125,6 +143,7 @@ void CatalogManager::DropTable(const string &table_name) {
     throw invalid_ident("table not found");
   }
   tables_.erase(table_name);
+  LogSnapshot();
 }
 
 CatalogManager catalog_manager;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <ostream>
 #include <unordered_map>
 using std::unordered_map;
 
@@ -8,6 +9,21 @@ using std::unordered_map;
 struct CatalogBlock : public Block {};
 
 class CatalogManager {
+  // the catalog files from before the magic number have no table layouts
+  static constexpr uint64_t kMagic = 0x325441434c51534d;  // "MSQLCAT2"
+
+  /**
+   * @brief write the catalog as it is stored in its file
+   *
+   * @param os the stream
+   */
+  void Save(std::ostream &os) const;
+
+  /**
+   * @brief log a snapshot of the catalog after it is changed
+   */
+  void LogSnapshot() const;
+
  public:
    unordered_map<string, Table> tables_;
 
@@ -28,10 +44,12 @@ class CatalogManager {
    *
    * @param table_name the name of the table
    * @param attributes the attributes of the table
+   * @param layout how the records are stored
    */
   void CreateTable(
       const string &table_name,
-      const vector<tuple<string, SqlValueType, SpecialAttribute>> &attributes);
+      const vector<tuple<string, SqlValueType, SpecialAttribute>> &attributes,
+      const TableLayout &layout = TableLayout::Row);
 
   /**
    * @brief Create an index
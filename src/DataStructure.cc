@@ -1,11 +1,12 @@
 #include "DataStructure.hpp"
 
-void Table::read(ifstream &is) {
+void Table::read(ifstream &is, bool has_layout) {
   size_t size;
   is.read(reinterpret_cast<char *>(&size), sizeof(size));
   table_name.resize(size);
   is.read(reinterpret_cast<char *>(table_name.data()), sizeof(char) * size);
 
+  attributes.clear();
   is.read(reinterpret_cast<char *>(&size), sizeof(size));
   while (size--) {
     size_t index;
@@ -27,6 +28,7 @@ void Table::read(ifstream &is) {
         index, type, static_cast<SpecialAttribute>(special_attribute), offset);
   }
 
+  indexes.clear();
   is.read(reinterpret_cast<char *>(&size), sizeof(size));
   while (size--) {
     size_t length;
@@ -41,9 +43,16 @@ void Table::read(ifstream &is) {
     is.read(reinterpret_cast<char *>(index_name.data()), sizeof(char) * length);
     indexes[column_name] = index_name;
   }
+
+  auto layout_type = static_cast<unsigned>(TableLayout::Row);
+  if (has_layout)
+    is.read(reinterpret_cast<char *>(&layout_type), sizeof(layout_type));
+  if (!is || layout_type > static_cast<unsigned>(TableLayout::Pax))
+    throw std::runtime_error("corrupt table " + table_name + " in the catalog");
+  layout = static_cast<TableLayout>(layout_type);
 }
 
-void Table::write(ofstream &os) const {
+void Table::write(std::ostream &os) const {
   auto size = table_name.length();
   os.write(reinterpret_cast<const char *>(&size), sizeof(size));
   os.write(table_name.c_str(), sizeof(char) * size);
@@ -76,6 +85,9 @@ void Table::write(ofstream &os) const {
     os.write(reinterpret_cast<const char *>(&size), sizeof(size));
     os.write(index.second.c_str(), sizeof(char) * size);
   }
+
+  const unsigned layout_type = static_cast<unsigned>(layout);
+  os.write(reinterpret_cast<const char *>(&layout_type), sizeof(layout_type));
 }
 
 size_t Table::getAttributeSize() const {
@@ -99,7 +111,7 @@ size_t Table::getAttributeSize() const {
 }
 
 Tuple Table::makeEmptyTuple() const {
-  static Tuple res;
+  static thread_local Tuple res;
   if (!res.values.empty()) res.values.clear();
   size_t cnt = attributes.size();
   res.values.resize(cnt);
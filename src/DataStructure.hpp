@@ -1,8 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <map>
+#include <shared_mutex>
 #include <stdexcept>
 #include <string>
 #include <tuple>
@@ -29,15 +32,70 @@ namespace Config {
 const string kRecordFileName = CommonPathPrefix "Record.data";
 const string kIndexFileName = CommonPathPrefix "Index.data";
 const string kCatalogFileName = CommonPathPrefix "Catalog.data";
+// constant-initialized, since buffer_manager uses them in its constructor
+const char kSuperBlockFileName[] = CommonPathPrefix "Super.data";
+const char kTablespaceFilePrefix[] = CommonPathPrefix "Tablespace.";
+const char kLogFileName[] = CommonPathPrefix "Log.data";
 const int kMaxStringLength = 256;
-const int kBlockSize = 16 * 1024;
-const int kNodeCapacity =
-    (kBlockSize - sizeof(size_t) - 16 - 8) / (kMaxStringLength + 16) + 1;
+// a page on the disk is a header (checksum, type and LSN) and a block
+const int kPageSize = 16 * 1024;
+const int kPageHeaderSize = 16;
+const int kBlockSize = kPageSize - kPageHeaderSize;
+const size_t kBlocksPerDataFile = 64 * 1024;  // 1 GiB per data file
+const size_t kDataFileExtent = 1024;          // preallocated 16 MiB at a time
+// the buffers, offsets and sizes of O_DIRECT must be aligned to the logical
+// block size of the device, which is at most a page
+const size_t kDirectIOAlignment = 4096;
+// the default size of the buffer, overridden by `--buffer-blocks=<n>` or the
+// environment variable kBufferBlocksEnv
 #ifdef _DEBUG
 const int kMaxBlockNum = 10;
 #else
 const int kMaxBlockNum = 512;
 #endif
+const char kBufferBlocksEnv[] = "MINISQL_BUFFER_BLOCKS";
+// the number of blocks read ahead by a sequential scan, overridden by
+// `--read-ahead=<n>` or the environment variable kReadAheadEnv
+const size_t kReadAheadBlocks = 8;
+const char kReadAheadEnv[] = "MINISQL_READ_AHEAD";
+const int kPrefetchThreadNum = 2;
+// the flusher writes back the dirty blocks when they are more than
+// kDirtyLowPercent of the buffer (checked every kFlushIntervalMs), and is
+// woken up at once when they are more than kDirtyHighPercent; overridden by
+// `--dirty-low=<percent>`, `--dirty-high=<percent>` or the environment
+// variables kDirtyLowEnv and kDirtyHighEnv
+const size_t kDirtyLowPercent = 10;
+const size_t kDirtyHighPercent = 30;
+const char kDirtyLowEnv[] = "MINISQL_DIRTY_LOW";
+const char kDirtyHighEnv[] = "MINISQL_DIRTY_HIGH";
+const int kFlushIntervalMs = 100;
+const size_t kMaxWriteRun = 64;     // blocks coalesced into one write at most
+const size_t kMaxWriteBatch = 64;   // blocks written back by one batch at most
+const unsigned kUringEntries = 64;  // the submission queue of io_uring
+const size_t kScrubBatch = 64;      // pages verified by one task of a scrub
+// whether a statement waits for its log records to reach the disk, overridden
+// by `--sync-commit=<0|1>` or the environment variable kSyncCommitEnv; without
+// it the log is written when kLogBufferSize bytes are pending, by the flusher
+// or before the blocks it covers
+const bool kSyncCommit = true;
+const char kSyncCommitEnv[] = "MINISQL_SYNC_COMMIT";
+const size_t kLogBufferSize = 1024 * 1024;
+// a fuzzy checkpoint writes back the dirty blocks and cuts off the log before
+// the oldest change which isn't on the disk yet, every
+// kCheckpointIntervalSec seconds (0: never), when the dirty blocks are more
+// than kCheckpointDirtyPercent of the buffer, or when the log to replay grows
+// larger than kCheckpointLogSize bytes; overridden by
+// `--checkpoint-interval=<seconds>`, `--checkpoint-dirty=<percent>` or the
+// environment variables kCheckpointIntervalEnv and kCheckpointDirtyEnv
+const size_t kCheckpointIntervalSec = 30;
+const size_t kCheckpointDirtyPercent = 50;
+const char kCheckpointIntervalEnv[] = "MINISQL_CHECKPOINT_INTERVAL";
+const char kCheckpointDirtyEnv[] = "MINISQL_CHECKPOINT_DIRTY";
+const size_t kCheckpointLogSize = 64 * 1024 * 1024;
+// the database is opened read-only when the environment variable kReadOnlyEnv
+// is 1; it is opened before the options are parsed, so `--read-only` only
+// checks that it is
+const char kReadOnlyEnv[] = "MINISQL_READ_ONLY";
 }  // namespace Config
 
 enum struct Operator { GT, GE, LT, LE, EQ, NE };
@@ -124,26 +182,33 @@ struct Tuple {
 
 enum struct SpecialAttribute { None, PrimaryKey, UniqueKey };
 
+// how the records of a table are stored in its blocks: row by row in slotted
+// pages, or column by column in minipages (PAX) for scan-heavy tables
+enum struct TableLayout { Row, Pax };
+
 struct Table {
   string table_name;
   /* the first size_t: the index in Tuple
    * the second size_t: the offset of the attribute in the record */
   map<string, tuple<size_t, SqlValueType, SpecialAttribute, size_t>> attributes;
   map<string, string> indexes;  // attribute name, index name
+  TableLayout layout = TableLayout::Row;
 
   /**
    * @brief read raw data from ifstream
    *
    * @param is the ifstream
+   * @param has_layout whether the layout was written, a catalog from before
+   * the layouts only has row tables
    */
-  void read(ifstream &is);
+  void read(ifstream &is, bool has_layout);
 
   /**
-   * @brief write raw data into ofstream
+   * @brief write raw data into a stream
    *
-   * @param os the ofstream
+   * @param os the stream
    */
-  void write(ofstream &os) const;
+  void write(std::ostream &os) const;
 
   /**
    * @brief get the size (in bytes) of each attribute
@@ -159,10 +224,51 @@ struct Table {
 };
 
 struct Block {
-  char val_[Config::kBlockSize];
-  bool dirty_, pin_;  // CAUTION: set dirty_ to true after modification
+  char *page_ = nullptr;  // Config::kPageSize bytes in the buffer's FrameArena
+  char *val_ = nullptr;   // Config::kBlockSize bytes after the page header
+  // the block can't be swapped out until every reader unpins it
+  std::atomic<int> pin_count_ = 0;
+  // the LSN of the last log record of the block, the log is written up to it
+  // before the block is written back
+  std::atomic<uint64_t> lsn_ = 0;
+  // the LSN before the first log record since the block was last written
+  // back, 0 if it is on the disk; a checkpoint keeps the log after it
+  std::atomic<uint64_t> rec_lsn_ = 0;
+  // shared: reading val_ (or writing it back), exclusive: modifying val_
+  std::shared_mutex latch_;
   Block() = default;
   virtual ~Block() = default;
+  /**
+   * @brief mark the block as modified (CAUTION: call it with latch_ held
+   * exclusively, so that the write-back can't miss the modification)
+   */
+  void MarkDirty() {
+    if (!dirty_.exchange(true)) dirty_num_.fetch_add(1);
+  }
+  /**
+   * @brief mark the block as written back
+   *
+   * @return whether the block was dirty
+   */
+  bool ClearDirty() {
+    if (!dirty_.exchange(false)) return false;
+    dirty_num_.fetch_sub(1);
+    return true;
+  }
+  bool IsDirty() const { return dirty_.load(std::memory_order_relaxed); }
+  /**
+   * @brief get the number of the dirty blocks
+   */
+  static size_t DirtyNum() { return dirty_num_.load(); }
+  /**
+   * @brief pin the block again (CAUTION: it should already be pinned, call
+   * BufferManager::Read to pin a block for the first time)
+   */
+  void Pin() { pin_count_.fetch_add(1, std::memory_order_relaxed); }
+  /**
+   * @brief release a pin taken by BufferManager::Read or Pin()
+   */
+  void Unpin() { pin_count_.fetch_sub(1, std::memory_order_release); }
   /**
    * @brief Get the filename of a block by block_id
    *
@@ -172,22 +278,25 @@ struct Block {
   static string GetBlockFilename(size_t block_id) {
     return CommonPathPrefix + std::to_string(block_id) + ".block";
   };
-  /**
-   * @brief read raw data from ifstream
-   *
-   * @param os the ifstream
-   */
-  void read(ifstream &is) { is.read(val_, Config::kBlockSize); }
-  /**
-   * @brief write raw data into ofstream
-   *
-   * @param os the ofstream
-   */
-  void write(ofstream &os) const { os.write(val_, Config::kBlockSize); }
+
+ private:
+  std::atomic<bool> dirty_ = false;
+  static inline std::atomic<size_t> dirty_num_ = 0;
 };
 
 struct Position {
   size_t block_id, offset;
+  bool operator<(const Position &rhs) const {
+    return std::tie(block_id, offset) < std::tie(rhs.block_id, rhs.offset);
+  }
+  bool operator==(const Position &rhs) const {
+    return block_id == rhs.block_id && offset == rhs.offset;
+  }
+};
+
+struct VacuumStats {
+  size_t moved;     // the records moved into the free slots of other blocks
+  size_t released;  // the blocks emptied and freed
 };
 
 struct Condition {
@@ -215,3 +324,13 @@ class invalid_index_attribute : public std::runtime_error {
  public:
   invalid_index_attribute(const char *what) : runtime_error(what) {}
 };
+
+class read_only_error : public std::runtime_error {
+ public:
+  read_only_error(const char *what) : runtime_error(what) {}
+};
+
+class corrupt_page_error : public std::runtime_error {
+ public:
+  corrupt_page_error(const std::string &what) : runtime_error(what) {}
+};
@@ -1,10 +1,19 @@
 #include "IndexManager.hpp"
 
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
 #include <exception>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <map>
+#include <set>
+#include <mutex>
+#include <sstream>
+#include <utility>
 
 #include "BufferManager.hpp"
 #include "CatalogManager.hpp"
@@ -15,536 +24,1277 @@ using namespace std;
 using std::cerr;
 using std::endl;
 
-getBplus::getBplus(size_t blk_id, SqlValueType p, string n)
-        : block_id_(blk_id), value_type_(p), index_name(n) {
-      if (block_id_ == NEWBLOCK) {
-        cur_blk_ = nullptr;
-        data_ = nullptr;
-        #ifdef _indexDEBUG
-        cout << "get null Node" << endl;
-        #endif
-        return;
-      }
-      #ifdef _indexDEBUG
-    cout << "get node" << endl;
-    #endif
-      root_id = blk_id;
-      cur_blk_ = static_cast<IndexBlock *>(buffer_manager.Read(block_id_));
-      cur_blk_->pin_ = true;
-      data_ = cur_blk_->val_;
-      getNodeInfo();
-    }
+size_t BplusNode::keySize(SqlValueType key_type) {
+  switch (key_type) {
+    case static_cast<SqlValueType>(SqlValueTypeBase::Integer):
+      return sizeof(int);
+    case static_cast<SqlValueType>(SqlValueTypeBase::Float):
+      return sizeof(float);
+    default:
+      return key_type - static_cast<SqlValueType>(SqlValueTypeBase::String);
+  }
+}
 
-void getBplus::releaseBlock() { if(cur_blk_) cur_blk_->pin_ = false; }
+size_t BplusNode::maxKeys(SqlValueType key_type) {
+  // the header, a pointer and a key with its pointer for each key
+  return (Config::kBlockSize - kPtrOffset - sizeof(Position)) /
+         (keySize(key_type) + sizeof(Position));
+}
 
-const bplusNode& getBplus::getNodeInfo() {
-    #ifdef _indexDEBUG
-    cout << "getting node info..." << endl;
-    #endif
-    Node_.elem.clear();
-    Node_.pos.clear();
-    char *tmp = data_;
-    Position pos;
-    SqlValue v;
-    memcpy(&element_num, tmp, sizeof(element_num));
-    tmp += sizeof(element_num);
-    memcpy(&pos, tmp, sizeof(pos));
-    tmp += sizeof(pos);
-    Node_.pos.push_back(pos);
-    #ifdef _indexDEBUG
-    cout << element_num << " " << Node_.pos[element_num].block_id << endl;
-    #endif
-    if(element_num!=0){
-    for (int i = 0; i < element_num; i++) {
-        memcpy(&pos, tmp, sizeof(pos));
-        tmp += sizeof(pos);
-        Node_.pos.push_back(pos);
-    }
-    for (int i = 0; i < element_num; i++) {
-        memcpy(&v.val, tmp, sizeof(v.val));
-        tmp += sizeof(v.val);
-        v.type = value_type_;
-        Node_.elem.push_back(v);
-    }
-    }
-    memcpy(&Node_.parent, tmp, sizeof(Node_.parent));
-    tmp += sizeof(Node_.parent);
-    memcpy(&Node_.type, tmp, sizeof(Node_.type));
-    #ifdef _indexDEBUG
-    cout << "get info! " << Node_.pos[element_num].block_id << endl;
-    #endif
-    return Node_;
+BplusNode::BplusNode(SqlValueType key_type, char *val)
+    : val_(val),
+      key_type_(key_type),
+      slotted_(key_type >=
+               static_cast<SqlValueType>(SqlValueTypeBase::String)),
+      key_size_(keySize(key_type)) {
+  if (slotted_) {
+    ptr_offset_ = kEntryOffset;
+    ptr_stride_ = kEntrySize;
+  } else {
+    max_keys_ = maxKeys(key_type);
+    key_offset_ = kPtrOffset + (max_keys_ + 1) * sizeof(Position);
+    ptr_offset_ = kPtrOffset;
+    ptr_stride_ = sizeof(Position);
+  }
 }
 
-void getBplus::newNode(NodeType t) {
-    size_t new_id = buffer_manager.NextId();
-    if (cur_blk_) {
-    releaseBlock();
-    }
-    cur_blk_ = static_cast<IndexBlock *>(buffer_manager.Read(new_id));
-    cur_blk_->pin_ = true;
-    cur_blk_->dirty_ = true;
-    block_id_ = new_id;
-    data_ = cur_blk_->val_;
-    memset(data_, 0, Config::kBlockSize);
-    *data_ = 0;
-    element_num = 0;
-    Node_.elem.clear();
-    Node_.pos.clear();
-    Node_.parent.block_id = NEWBLOCK;
-    Node_.type = t;
-    updateBlock();
+BplusNode::BplusNode(size_t id, SqlValueType key_type)
+    : BplusNode(key_type, nullptr) {
+  id_ = id;
+  blk_ = static_cast<IndexBlock *>(buffer_manager.Read(id, AccessClass::Index));
+  val_ = blk_->val_;
 }
 
-void getBplus::switchToBlock(size_t blk_id) {
-    #ifdef _indexDEBUG
-    cout << "block switching..." << endl;
-    #endif
-    if (cur_blk_) {
-    releaseBlock();
-    }
-    cur_blk_ = static_cast<IndexBlock *>(buffer_manager.Read(blk_id));
-    cur_blk_->pin_ = true;
-    block_id_ = blk_id;
-    data_ = cur_blk_->val_;
-    getNodeInfo();
-}
-
-void getBplus::updateBlock() {
-    cur_blk_->dirty_ = true;
-    char *tmp = data_;
-    memcpy(tmp, &element_num, sizeof(element_num));
-    tmp += sizeof(element_num);
-    for (auto &v : Node_.pos) {
-    memcpy(tmp, &v, sizeof(v));
-    tmp += sizeof(v);
-    }
-    for (auto &v : Node_.elem) {
-    memcpy(tmp, &v.val, sizeof(v.val));
-    tmp += sizeof(v.val);
-    }
-    memcpy(tmp, &Node_.parent, sizeof(Node_.parent));
-    tmp += sizeof(Node_.parent);
-    memcpy(tmp, &Node_.type, sizeof(Node_.type));
+BplusNode::BplusNode(NodeType type, SqlValueType key_type)
+    : BplusNode(key_type, nullptr) {
+  blk_ = static_cast<IndexBlock *>(buffer_manager.Create(id_, PageType::Index));
+  val_ = blk_->val_;
+  clear(type);
+}
+
+BplusNode::BplusNode(char *image, NodeType type, SqlValueType key_type)
+    : BplusNode(key_type, image) {
+  clear(type);
+}
+
+BplusNode::BplusNode(BplusNode &&other) noexcept
+    : id_(other.id_),
+      blk_(std::exchange(other.blk_, nullptr)),
+      val_(std::exchange(other.val_, nullptr)),
+      key_type_(other.key_type_),
+      slotted_(other.slotted_),
+      key_size_(other.key_size_),
+      max_keys_(other.max_keys_),
+      key_offset_(other.key_offset_),
+      ptr_offset_(other.ptr_offset_),
+      ptr_stride_(other.ptr_stride_) {}
+
+BplusNode &BplusNode::operator=(BplusNode &&other) noexcept {
+  if (this != &other) {
+    release();
+    id_ = other.id_;
+    blk_ = std::exchange(other.blk_, nullptr);
+    val_ = std::exchange(other.val_, nullptr);
+    key_type_ = other.key_type_;
+    slotted_ = other.slotted_;
+    key_size_ = other.key_size_;
+    max_keys_ = other.max_keys_;
+    key_offset_ = other.key_offset_;
+    ptr_offset_ = other.ptr_offset_;
+    ptr_stride_ = other.ptr_stride_;
+  }
+  return *this;
+}
+
+void BplusNode::release() {
+  if (blk_) blk_->Unpin();
+  blk_ = nullptr;
+  val_ = nullptr;
+}
+
+void BplusNode::clear(NodeType type) {
+  const Header header{0, type, {ROOT, 0}};
+  const SlotHeader slots{static_cast<uint16_t>(Config::kBlockSize),
+                         0,
+                         0,
+                         0,
+                         kNoFence,
+                         0,
+                         kNoFence};
+  const auto latch = modify();
+  memcpy(val_, &header, sizeof(header));
+  if (slotted_) memcpy(val_ + kPtrOffset, &slots, sizeof(slots));
+  logRange(val_, val_ + (slotted_ ? kEntryOffset : sizeof(header)));
+}
+
+BplusNode::Header BplusNode::header() const {
+  Header header;
+  memcpy(&header, val_, sizeof(header));
+  return header;
+}
+
+BplusNode::SlotHeader BplusNode::slotHeader() const {
+  SlotHeader header;
+  memcpy(&header, val_ + kPtrOffset, sizeof(header));
+  return header;
+}
+
+BplusNode::Slot BplusNode::slot(size_t i) const {
+  Slot slot;
+  memcpy(&slot, slotAt(i), sizeof(slot));
+  return slot;
 }
 
+std::unique_lock<std::shared_mutex> BplusNode::modify() {
+  if (!blk_) return {};
+  std::unique_lock latch(blk_->latch_);
+  blk_->MarkDirty();
+  return latch;
+}
+
+void BplusNode::logRange(const char *begin, const char *end) {
+  if (blk_ && end > begin)
+    BufferManager::LogUpdate(id_, blk_, begin - val_, end - begin);
+}
+
+size_t BplusNode::storedSize(const char *key, size_t prefix) const {
+  return strnlen(key + prefix, key_size_ - prefix);
+}
+
+uint16_t BplusNode::putBytes(const char *bytes, size_t size, size_t reserve) {
+  if (slotHeader().heap < ptrAt(count() + 1) - val_ + reserve + size)
+    compact();
+  SlotHeader header = slotHeader();
+  assert(header.heap >= ptrAt(count() + 1) - val_ + reserve + size);
+  header.heap -= size;
+  memcpy(val_ + header.heap, bytes, size);
+  memcpy(val_ + kPtrOffset, &header, sizeof(header));
+  logRange(val_ + kPtrOffset, val_ + kEntryOffset);
+  logRange(val_ + header.heap, val_ + header.heap + size);
+  return header.heap;
+}
+
+void BplusNode::compact() {
+  static thread_local char copy[Config::kBlockSize];
+  memcpy(copy, val_, Config::kBlockSize);
+  SlotHeader header = slotHeader();
+  size_t heap = Config::kBlockSize;
+  const auto move = [&](uint16_t &offset, size_t size) {
+    heap -= size;
+    memcpy(val_ + heap, copy + offset, size);
+    offset = heap;
+  };
+  if (header.low_size != kNoFence) move(header.low, header.low_size);
+  if (header.high_size != kNoFence) move(header.high, header.high_size);
+  const size_t n = count();
+  for (size_t i = 0; i < n; i++) {
+    Slot s = slot(i);
+    move(s.offset, s.size);
+    memcpy(slotAt(i), &s, sizeof(s));
+  }
+  header.heap = heap;
+  header.garbage = 0;
+  memcpy(val_ + kPtrOffset, &header, sizeof(header));
+  logRange(val_ + kPtrOffset, ptrAt(n + 1));
+  logRange(val_ + heap, val_ + Config::kBlockSize);
+}
+
+Position BplusNode::ptr(size_t i) const {
+  Position pos;
+  memcpy(&pos, ptrAt(i), sizeof(pos));
+  return pos;
+}
+
+void BplusNode::copyKey(size_t i, char *key) const {
+  if (!slotted_) {
+    memcpy(key, keyAt(i), key_size_);
+    return;
+  }
+  const SlotHeader header = slotHeader();
+  const Slot s = slot(i);
+  memcpy(key, val_ + header.low, header.prefix);
+  memcpy(key + header.prefix, val_ + s.offset, s.size);
+  memset(key + header.prefix + s.size, 0,
+         key_size_ - header.prefix - s.size);
+}
+
+size_t BplusNode::keyLength(size_t i) const {
+  return slotted_ ? slotHeader().prefix + slot(i).size : key_size_;
+}
+
+bool BplusNode::copyFence(bool high, char *key) const {
+  if (!slotted_) return false;
+  const SlotHeader header = slotHeader();
+  const size_t size = high ? header.high_size : header.low_size;
+  if (size == kNoFence) return false;
+  memcpy(key, val_ + (high ? header.high : header.low), size);
+  memset(key + size, 0, key_size_ - size);
+  return true;
+}
 
 /**
- * @brief insert ONE value into index
- * the cur_block_ should be set to ROOT before insert()
- * */
-void getBplus::insert(SqlValue val, Position pos) {
-    #ifdef _indexDEBUG
-    cout << "start insert()" << endl;
-    #endif
-    int maxElem = Config::kNodeCapacity - 1;
-    // find the leafNode
-    int i = 0;
-    while (Node_.type != NodeType::LeafNode) {
-    size_t Next_blk;
-    while (i < element_num) {
-        if (Node_.elem[i].Compare(Operator::GT, val)) break;
-        i++;
-    }
-    Next_blk = Node_.pos[i].block_id;
-    switchToBlock(Next_blk);
-    }
-    #ifdef _indexDEBUG
-    cout << "reach the leaf" << endl;
-    #endif
-    // reach the leafNode
-    // find insert position
-    for (i = 0; i < element_num; i++) {
-    if (Node_.elem[i].Compare(Operator::GT, val)) break;
+ * @brief compare the bytes of a key, without its trailing '\0's, with a
+ * value padded with '\0's, like strncmp
+ *
+ * @param size the number of bytes of the key
+ * @param val_size the size of the value
+ */
+static int compareBytes(const char *key, size_t size, const char *val,
+                        size_t val_size) {
+  const int cmp = strncmp(key, val, size);
+  if (cmp != 0) return cmp;
+  return size < val_size && val[size] ? -1 : 0;
+}
+
+int BplusNode::compare(size_t i, const SqlValue &val) const {
+  switch (key_type_) {
+    case static_cast<SqlValueType>(SqlValueTypeBase::Integer): {
+      int x;
+      memcpy(&x, keyAt(i), sizeof(x));
+      return (x > val.val.Integer) - (x < val.val.Integer);
     }
-    // insert into "Node_"
-    Node_.elem.insert(Node_.elem.begin() + i, val);
-    Node_.pos.insert(Node_.pos.begin() + i, pos);
-    element_num++;
-
-    // insert into real Index
-    if (element_num <= maxElem) {
-    updateBlock();
-    #ifdef _indexDEBUG
-    cout << "insert without split" << endl;
-    #endif
+    case static_cast<SqlValueType>(SqlValueTypeBase::Float): {
+      float x;
+      memcpy(&x, keyAt(i), sizeof(x));
+      return (x > val.val.Float) - (x < val.val.Float);
     }
-    // the leafnode needs to split
-    else {
-    #ifdef _indexDEBUG
-    cout << "need to split" << endl;
-    #endif
-    splitLeaf();
+    default: {
+      const SlotHeader header = slotHeader();
+      const int cmp = strncmp(val_ + header.low, val.val.String, header.prefix);
+      if (cmp != 0) return cmp;
+      const Slot s = slot(i);
+      return compareBytes(val_ + s.offset, s.size,
+                          val.val.String + header.prefix,
+                          key_size_ - header.prefix);
     }
-    #ifdef _indexDEBUG
-    cout << "insert new record, now root id: " << root_id << endl;
-    #endif
+  }
 }
 
-void getBplus::splitLeaf() {
-    vector<SqlValue> temp_val;
-    vector<Position> temp_pos;
-    Position temp_parent = Node_.parent;
-    NodeType temp_type = Node_.type;
-    temp_val.insert(temp_val.begin(), Node_.elem.begin(), Node_.elem.end());
-    temp_pos.insert(temp_pos.begin(), Node_.pos.begin(), Node_.pos.end());
-
-    Node_.elem.clear();
-    Node_.pos.clear();
-    int left_ = element_num / 2;
-    int right_ = element_num - left_;
-    Node_.elem.insert(Node_.elem.begin(), temp_val.begin(),
-                    temp_val.begin() + left_);
-    Node_.pos.insert(Node_.pos.begin(), temp_pos.begin(),
-                    temp_pos.begin() + left_);
-    size_t blk_id_ = buffer_manager.NextId();
-    Position p = {blk_id_, 0};
-    Node_.pos.push_back(p);
-    element_num = left_;
-    blk_id_ = block_id_;
-
-    updateBlock();
-    newNode(temp_type);
-    Node_.elem.insert(Node_.elem.begin(), temp_val.begin() + left_,
-                    temp_val.end());
-    Node_.pos.insert(Node_.pos.begin(), temp_pos.begin() + left_,
-                    temp_pos.end());
-    Node_.parent = temp_parent;
-    Node_.type = temp_type;
-    element_num = right_;
-    updateBlock();
-
-    insert_in_parent(blk_id_, block_id_, Node_.elem[0]);
+/**
+ * @brief count the sorted int keys before a value, i.e. less than it, or not
+ * greater than it if kUpper
+ *
+ * @param keys the keys
+ * @param n the number of keys
+ */
+template <bool kUpper>
+static size_t countBefore(const char *keys, size_t n, int val) {
+  size_t i = 0, before = 0;
+#ifdef __AVX2__
+  const __m256i v8 = _mm256_set1_epi32(val);
+  for (; i + 8 <= n; i += 8) {
+    const __m256i k = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(keys + i * sizeof(int)));
+    const __m256i m =
+        kUpper ? _mm256_cmpgt_epi32(k, v8) : _mm256_cmpgt_epi32(v8, k);
+    const int bits = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+    before += kUpper ? 8 - __builtin_popcount(bits) : __builtin_popcount(bits);
+  }
+#endif
+  const __m128i v4 = _mm_set1_epi32(val);
+  for (; i + 4 <= n; i += 4) {
+    const __m128i k = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(keys + i * sizeof(int)));
+    const __m128i m = kUpper ? _mm_cmpgt_epi32(k, v4) : _mm_cmpgt_epi32(v4, k);
+    const int bits = _mm_movemask_ps(_mm_castsi128_ps(m));
+    before += kUpper ? 4 - __builtin_popcount(bits) : __builtin_popcount(bits);
+  }
+  for (; i < n; i++) {
+    int x;
+    memcpy(&x, keys + i * sizeof(int), sizeof(x));
+    before += kUpper ? x <= val : x < val;
+  }
+  return before;
 }
 
-/**
- * the cur_Node_ should be set to
- * */
-void getBplus::insert_in_parent(size_t old_id, size_t new_id, SqlValue k) {
-    Position new_node = {new_id, 0};
-    Position old_node = {old_id, 0};
-    size_t blk_id_ = Node_.parent.block_id;
-
-    if (blk_id_ == ROOT) {
-    #ifdef _indexDEBUG
-    cout << "need to create new root" << endl;
-    #endif
-    newNode(NodeType::Root);
-    Node_.pos.push_back(old_node);
-    Node_.elem.push_back(k);
-    Node_.pos.push_back(new_node);
-    element_num = 1;
-    Node_.parent.block_id = ROOT;
-    root_id = block_id_;
-    updateBlock();
-    blk_id_ = block_id_;
-
-    switchToBlock(old_id);
-    Node_.parent.block_id = blk_id_;
-    if (Node_.type == NodeType::Root) Node_.type = NodeType::nonLeafNode;
-    updateBlock();
-
-    switchToBlock(new_id);
-    Node_.parent.block_id = blk_id_;
-    if (Node_.type == NodeType::Root) Node_.type = NodeType::nonLeafNode;
-    updateBlock();
-    } 
-    else {
-    switchToBlock(blk_id_);
-    int i;
-    for (i = 0; i < element_num; i++) {
-        if (Node_.elem[i].Compare(Operator::GT, k)) break;
-    }
-    // insert into "Node_"
-    auto e = Node_.elem.begin();
-    Node_.elem.insert(e + i, k);
-    auto p = Node_.pos.begin();
-    Node_.pos.insert(p + i, new_node);
-    element_num++;
-
-    if (element_num <= Config::kNodeCapacity - 1) {
-        updateBlock();
-    } else {  // split the parent node
-        vector<SqlValue> temp_val;
-        vector<Position> temp_pos;
-        Position temp_parent = Node_.parent;
-        NodeType temp_type = Node_.type;
-        temp_val.insert(temp_val.begin(), Node_.elem.begin(),
-                        Node_.elem.end());
-        temp_pos.insert(temp_pos.begin(), Node_.pos.begin(), Node_.pos.end());
-
-        Node_.elem.clear();
-        Node_.pos.clear();
-        int left_ = element_num / 2;
-        int right_ = element_num - left_ - 1;
-        Node_.elem.insert(Node_.elem.begin(), temp_val.begin(),
-                        temp_val.begin() + left_);
-        Node_.pos.insert(Node_.pos.begin(), temp_pos.begin(),
-                        temp_pos.begin() + left_ + 1);
-        element_num = left_;
-        blk_id_ = block_id_;
-
-        updateBlock();
-        newNode(Node_.type);
-        Node_.elem.insert(Node_.elem.begin(), temp_val.begin() + left_ + 1,
-                        temp_val.end());
-        Node_.pos.insert(Node_.pos.begin(), temp_pos.begin() + left_ + 1,
-                        temp_pos.end());
-        Node_.parent = temp_parent;
-        Node_.type = temp_type;
-        element_num = right_;
-        updateBlock();
-
-        size_t t = block_id_;
-        int j = element_num + 1;
-        for (i = 0; i < j; i++) {
-        switchToBlock(Node_.pos[i].block_id);
-        Node_.parent.block_id = t;
-        updateBlock();
-        switchToBlock(t);
-        }
+template <bool kUpper>
+static size_t countBefore(const char *keys, size_t n, float val) {
+  size_t i = 0, before = 0;
+#ifdef __AVX2__
+  const __m256 v8 = _mm256_set1_ps(val);
+  for (; i + 8 <= n; i += 8) {
+    const __m256 k =
+        _mm256_loadu_ps(reinterpret_cast<const float *>(keys) + i);
+    const __m256 m = _mm256_cmp_ps(k, v8, kUpper ? _CMP_LE_OQ : _CMP_LT_OQ);
+    before += __builtin_popcount(_mm256_movemask_ps(m));
+  }
+#endif
+  const __m128 v4 = _mm_set1_ps(val);
+  for (; i + 4 <= n; i += 4) {
+    const __m128 k = _mm_loadu_ps(reinterpret_cast<const float *>(keys) + i);
+    const __m128 m = kUpper ? _mm_cmple_ps(k, v4) : _mm_cmplt_ps(k, v4);
+    before += __builtin_popcount(_mm_movemask_ps(m));
+  }
+  for (; i < n; i++) {
+    float x;
+    memcpy(&x, keys + i * sizeof(float), sizeof(x));
+    before += kUpper ? x <= val : x < val;
+  }
+  return before;
+}
 
-        insert_in_parent(blk_id_, t, temp_val[left_]);
-    }
-    }
+template <bool kUpper, typename T>
+size_t BplusNode::searchNumbers(T val) const {
+  // the keys before base are before the value, the ones from base + n on
+  // aren't
+  const char *base = keyAt(0);
+  size_t n = count();
+  while (n > kSearchWindow) {
+    const size_t half = n / 2;
+    T x;
+    memcpy(&x, base + half * sizeof(T), sizeof(x));
+    const bool before = kUpper ? x <= val : x < val;
+    base = before ? base + half * sizeof(T) : base;
+    n -= half;
+  }
+  return (base - keyAt(0)) / sizeof(T) + countBefore<kUpper>(base, n, val);
 }
 
-size_t getBplus::findLeaf(SqlValue val) {
-    int i = 0;
-    while (Node_.type != NodeType::LeafNode) {
-    #ifdef _indexDEBUG
-    cout << "not leafNode, get down" << endl;
-    #endif
-    size_t Next_blk;
-    i = 0;
-    while (i < element_num) {
-        #ifdef _indexDEBUG
-        cout << "current node: " << block_id_ << " " << Node_.elem[i].val.String << endl;
-        #endif
-        if (Node_.elem[i].Compare(Operator::GT, val)) break;
-        i++;
-    }
-    #ifdef _indexDEBUG
-    cout << "reach Node: " << block_id_ << " " << Node_.elem[i].val.String << " " << Node_.pos[i].block_id << endl;
-    #endif
-    Next_blk = Node_.pos[i].block_id;
-    switchToBlock(Next_blk);
-    }
-    #ifdef _indexDEBUG
-    cout << "reach leaf: " << block_id_ << endl;
-    #endif
-    return block_id_;
+template <bool kUpper>
+size_t BplusNode::searchSlots(const char *val) const {
+  const SlotHeader header = slotHeader();
+  size_t n = count();
+  const int cmp = strncmp(val_ + header.low, val, header.prefix);
+  if (cmp != 0) return cmp > 0 ? 0 : n;  // every key is after the value
+  if (n == 0) return 0;
+  const char *rest = val + header.prefix;
+  const size_t rest_size = key_size_ - header.prefix;
+  size_t base = 0;
+  while (n > 1) {
+    const size_t half = n / 2;
+    const Slot s = slot(base + half);
+    const int c = compareBytes(val_ + s.offset, s.size, rest, rest_size);
+    base = (kUpper ? c <= 0 : c < 0) ? base + half : base;
+    n -= half;
+  }
+  const Slot s = slot(base);
+  const int c = compareBytes(val_ + s.offset, s.size, rest, rest_size);
+  return base + (kUpper ? c <= 0 : c < 0);
 }
 
-Position getBplus::find(SqlValue val){
-    size_t leaf = findLeaf(val);
-    switchToBlock(leaf);
-    int i = 0;
-    while (i < element_num) {
-    if (Node_.elem[i].Compare(Operator::EQ, val)) break;
-    i++;
-    }
-    
-    return Node_.pos[i];
+template <bool kUpper>
+size_t BplusNode::search(const SqlValue &val) const {
+  switch (key_type_) {
+    case static_cast<SqlValueType>(SqlValueTypeBase::Integer):
+      return searchNumbers<kUpper>(val.val.Integer);
+    case static_cast<SqlValueType>(SqlValueTypeBase::Float):
+      return searchNumbers<kUpper>(val.val.Float);
+    default:
+      return searchSlots<kUpper>(val.val.String);
+  }
+}
+
+size_t BplusNode::lowerBound(const SqlValue &val) const {
+  return search<false>(val);
+}
+
+size_t BplusNode::upperBound(const SqlValue &val) const {
+  return search<true>(val);
+}
+
+size_t BplusNode::childIndex(size_t child_id) const {
+  const size_t n = count();
+  size_t i = 0;
+  while (i < n && ptr(i).block_id != child_id) i++;
+  return i;
+}
+
+bool BplusNode::hasRoom(const char *key, size_t replaced) const {
+  if (!slotted_) return replaced != SIZE_MAX || count() < max_keys_;
+  const SlotHeader header = slotHeader();
+  size_t free = header.heap - (ptrAt(count() + 1) - val_) + header.garbage;
+  size_t size = storedSize(key, header.prefix);
+  if (replaced == SIZE_MAX)
+    size += kEntrySize;
+  else
+    free += slot(replaced).size;
+  return size <= free;
+}
+
+bool BplusNode::fits(size_t size) const {
+  if (!slotted_) return size / entrySize(0) <= max_keys_;
+  return kEntryOffset + kEntrySize + size <= slotHeader().heap;
+}
+
+bool BplusNode::underflow() const {
+  if (!slotted_) return count() < max_keys_ / 2;
+  const SlotHeader header = slotHeader();
+  const size_t used = (count() + 1) * kEntrySize + Config::kBlockSize -
+                      header.heap - header.garbage;
+  return used < (Config::kBlockSize - kEntryOffset) / 2;
+}
+
+void BplusNode::setType(NodeType type) {
+  const auto latch = modify();
+  char *field = val_ + offsetof(Header, type);
+  memcpy(field, &type, sizeof(type));
+  logRange(field, field + sizeof(type));
+}
+
+void BplusNode::setParent(size_t parent_id) {
+  const Position parent{parent_id, 0};
+  const auto latch = modify();
+  char *field = val_ + offsetof(Header, parent);
+  memcpy(field, &parent, sizeof(parent));
+  logRange(field, field + sizeof(parent));
+}
+
+void BplusNode::setPtr(size_t i, const Position &ptr) {
+  const auto latch = modify();
+  memcpy(ptrAt(i), &ptr, sizeof(ptr));
+  logRange(ptrAt(i), ptrAt(i) + sizeof(ptr));
+}
+
+void BplusNode::setKey(size_t i, const char *key) {
+  const auto latch = modify();
+  if (!slotted_) {
+    memcpy(keyAt(i), key, key_size_);
+    logRange(keyAt(i), keyAt(i + 1));
+    return;
+  }
+  // the old bytes are dropped before the node may be compacted
+  SlotHeader header = slotHeader();
+  Slot s = slot(i);
+  header.garbage += s.size;
+  memcpy(val_ + kPtrOffset, &header, sizeof(header));
+  s.size = 0;
+  memcpy(slotAt(i), &s, sizeof(s));
+  s.size = storedSize(key, header.prefix);
+  s.offset = putBytes(key + header.prefix, s.size, 0);
+  memcpy(slotAt(i), &s, sizeof(s));
+  logRange(slotAt(i), slotAt(i) + sizeof(s));
+}
+
+void BplusNode::setFences(const char *low, const char *high) {
+  if (!slotted_) return;
+  const auto latch = modify();
+  SlotHeader header = slotHeader();
+  const auto put = [&](const char *key, uint16_t &offset, uint16_t &size) {
+    if (!key) return;
+    size = strnlen(key, key_size_);
+    assert(header.heap >= ptrAt(count() + 1) - val_ + size);
+    header.heap -= size;
+    memcpy(val_ + header.heap, key, size);
+    offset = header.heap;
+  };
+  put(low, header.low, header.low_size);
+  put(high, header.high, header.high_size);
+  header.prefix = 0;
+  if (low && high)
+    while (header.prefix < header.low_size &&
+           header.prefix < header.high_size &&
+           low[header.prefix] == high[header.prefix])
+      header.prefix++;
+  memcpy(val_ + kPtrOffset, &header, sizeof(header));
+  logRange(val_ + kPtrOffset, val_ + kEntryOffset);
+  logRange(val_ + header.heap, val_ + Config::kBlockSize);
+}
+
+void BplusNode::insert(size_t key_idx, const char *key, size_t ptr_idx,
+                       const Position &ptr) {
+  const size_t n = count();
+  const auto latch = modify();
+  if (slotted_) {
+    // the entries move with their keys, the key goes into the entry before
+    // the one of the pointer in an internal node
+    const size_t prefix = slotHeader().prefix;
+    const uint16_t size = storedSize(key, prefix);
+    const Slot s{putBytes(key + prefix, size, kEntrySize), size};
+    memmove(ptrAt(key_idx + 1), ptrAt(key_idx), (n + 1 - key_idx) * kEntrySize);
+    memcpy(slotAt(key_idx), &s, sizeof(s));
+  } else {
+    memmove(keyAt(key_idx + 1), keyAt(key_idx), (n - key_idx) * key_size_);
+    memcpy(keyAt(key_idx), key, key_size_);
+    memmove(ptrAt(ptr_idx + 1), ptrAt(ptr_idx),
+            (n + 1 - ptr_idx) * sizeof(Position));
+    logRange(keyAt(key_idx), keyAt(n + 1));
+  }
+  memcpy(ptrAt(ptr_idx), &ptr, sizeof(ptr));
+  const int32_t new_count = n + 1;
+  memcpy(val_ + offsetof(Header, count), &new_count, sizeof(new_count));
+  logRange(val_, val_ + sizeof(new_count));
+  logRange(ptrAt(key_idx), ptrAt(n + 2));
+}
+
+void BplusNode::erase(size_t key_idx, size_t ptr_idx) {
+  const size_t n = count();
+  const auto latch = modify();
+  if (slotted_) {
+    SlotHeader header = slotHeader();
+    header.garbage += slot(key_idx).size;
+    memcpy(val_ + kPtrOffset, &header, sizeof(header));
+    logRange(val_ + kPtrOffset, val_ + kEntryOffset);
+    // the pointer before the key stays in an internal node
+    if (ptr_idx != key_idx)
+      memcpy(ptrAt(ptr_idx), ptrAt(key_idx), sizeof(Position));
+    memmove(ptrAt(key_idx), ptrAt(key_idx + 1), (n - key_idx) * kEntrySize);
+  } else {
+    memmove(keyAt(key_idx), keyAt(key_idx + 1), (n - key_idx - 1) * key_size_);
+    memmove(ptrAt(ptr_idx), ptrAt(ptr_idx + 1),
+            (n - ptr_idx) * sizeof(Position));
+    logRange(keyAt(key_idx), keyAt(n - 1));
+  }
+  const int32_t new_count = n - 1;
+  memcpy(val_ + offsetof(Header, count), &new_count, sizeof(new_count));
+  logRange(val_, val_ + sizeof(new_count));
+  logRange(ptrAt(key_idx), ptrAt(n));
 }
 
-Position getBplus::findMin(){
-    size_t blk_id;
-    while(Node_.type!=NodeType::LeafNode){
-        blk_id = Node_.pos[0].block_id;
-        switchToBlock(blk_id);
+void BplusNode::assign(const BplusNode &image) {
+  const size_t n = image.count();
+  const auto latch = modify();
+  memcpy(val_, image.val_, image.ptrAt(n + 1) - image.val_);
+  logRange(val_, ptrAt(n + 1));
+  if (slotted_) {
+    const size_t heap = image.slotHeader().heap;
+    memcpy(val_ + heap, image.val_ + heap, Config::kBlockSize - heap);
+    logRange(val_ + heap, val_ + Config::kBlockSize);
+  } else {
+    memcpy(keyAt(0), image.keyAt(0), n * key_size_);
+    logRange(keyAt(0), keyAt(n));
+  }
+}
+
+struct Entries {
+  const BplusNode *a;  // the keys [0, a_keys) of a come first
+  size_t a_keys;
+  const char *key;     // then this key, if any
+  const BplusNode *b;  // then the keys [b_key, count) of b
+  size_t b_key;
+  size_t a_ptrs;        // the pointers [0, a_ptrs) of a come first
+  const Position *ptr;  // then this pointer, if any
+  size_t b_ptr;         // then the pointers [b_ptr, count] of b
+
+  size_t keys() const { return a_keys + (key != nullptr) + b->count() - b_key; }
+  void copyKey(size_t j, char *out) const {
+    if (j < a_keys) return a->copyKey(j, out);
+    j -= a_keys;
+    if (key && j-- == 0) {
+      memcpy(out, key, a->keySize());
+      return;
     }
-    return Node_.pos[0];
+    b->copyKey(b_key + j, out);
+  }
+  size_t keyLength(size_t j) const {
+    if (j < a_keys) return a->keyLength(j);
+    j -= a_keys;
+    if (key && j-- == 0)
+      return a->slotted() ? strnlen(key, a->keySize()) : a->keySize();
+    return b->keyLength(b_key + j);
+  }
+  Position ptrAt(size_t j) const {
+    if (j < a_ptrs) return a->ptr(j);
+    j -= a_ptrs;
+    if (ptr && j-- == 0) return *ptr;
+    return b->ptr(b_ptr + j);
+  }
+};
+
+/**
+ * @brief append some of the entries to a scratch node: a leaf takes the
+ * pointer of each key, an internal node the pointer before the first key and
+ * the one after each key
+ *
+ * @param from the index of the first key
+ * @param to the index after the last key
+ */
+static void fill(BplusNode &node, const Entries &entries, size_t from,
+                 size_t to) {
+  char key[Config::kMaxStringLength];
+  const bool leaf = node.isLeaf();
+  if (!leaf) node.setPtr(0, entries.ptrAt(from));
+  for (size_t j = from; j < to; j++) {
+    const size_t i = j - from;
+    entries.copyKey(j, key);
+    node.insert(i, key, leaf ? i : i + 1, entries.ptrAt(leaf ? j : j + 1));
+  }
 }
 
 /**
- * @brief delete ONE key in the index at one time
- * please set cur_blk_ to the rootNode before erase
- * */
-void getBplus::erase(SqlValue val) {
-    size_t targetLeaf = findLeaf(val);
-    delete_entry(targetLeaf, val);
-}
-
-void getBplus::delete_entry(size_t N, SqlValue K){
-    switchToBlock(N);
-    int i = 0;
-    while(i < element_num){
-        if(Node_.elem[i].Compare(Operator::EQ, K)) break;
-        i++;
-    }
-    if(i==element_num) return;
+ * @brief get the space some of the entries take in a scratch node, with its
+ * fences and prefix (see BplusNode::fits)
+ *
+ * @param from the index of the first key
+ * @param to the index after the last key
+ */
+static size_t entriesSize(const Entries &entries, const BplusNode &node,
+                          size_t from, size_t to) {
+  size_t size = 0;
+  for (size_t j = from; j < to; j++)
+    size += node.entrySize(entries.keyLength(j));
+  return size;
+}
 
-    if(Node_.type == NodeType::LeafNode){
-        Node_.elem.erase(Node_.elem.begin() + i);
-        Node_.pos.erase(Node_.pos.begin() + i);
-    }
-    else{
-        Node_.elem.erase(Node_.elem.begin() + i);
-        Node_.pos.erase(Node_.pos.begin() + i + 1);
+/**
+ * @brief get the number of keys in the first of two nodes which share some
+ * entries, so that the nodes take about the same space
+ *
+ * @param node a node with the prefix of the entries
+ * @param up whether the key after them goes up to the parent
+ */
+static size_t splitPoint(const Entries &entries, const BplusNode &node,
+                         bool up) {
+  const size_t n = entries.keys(), total = entriesSize(entries, node, 0, n);
+  size_t m = 0;
+  for (size_t first = 0; first < total / 2; m++)
+    first += node.entrySize(entries.keyLength(m));
+  return std::clamp(m, size_t{1}, n - 1 - up);
+}
+
+/**
+ * @brief get the separator of two leaves: the shortest prefix of the first
+ * key of the second one which is greater than the last key of the first one,
+ * for char keys, or the key itself
+ *
+ * @param m the index of the first key of the second leaf
+ * @param sep Config::kMaxStringLength bytes
+ */
+static void separator(const Entries &entries, size_t m, char *sep) {
+  entries.copyKey(m, sep);
+  if (!entries.a->slotted()) return;
+  char last[Config::kMaxStringLength];
+  entries.copyKey(m - 1, last);
+  const size_t size = entries.a->keySize();
+  size_t i = 0;
+  while (i + 1 < size && sep[i] == last[i]) i++;
+  memset(sep + i + 1, 0, size - i - 1);
+}
+
+PostingBlock::PostingBlock(size_t id)
+    : id_(id),
+      blk_(static_cast<IndexBlock *>(
+          buffer_manager.Read(id, AccessClass::Index))) {}
+
+PostingBlock::PostingBlock(const uint64_t *packed, size_t count, size_t next) {
+  blk_ = static_cast<IndexBlock *>(buffer_manager.Create(id_, PageType::Index));
+  std::unique_lock latch(blk_->latch_);
+  blk_->MarkDirty();
+  memcpy(positions(), packed, count * sizeof(uint64_t));
+  BufferManager::LogUpdate(id_, blk_, sizeof(Header),
+                           count * sizeof(uint64_t));
+  latch.unlock();
+  setHeader({static_cast<uint32_t>(count), 0, next});
+}
+
+void PostingBlock::release() {
+  if (blk_) blk_->Unpin();
+  blk_ = nullptr;
+}
+
+PostingBlock::Header PostingBlock::header() const {
+  Header header;
+  memcpy(&header, blk_->val_, sizeof(header));
+  return header;
+}
+
+void PostingBlock::setHeader(const Header &header) {
+  std::unique_lock latch(blk_->latch_);
+  blk_->MarkDirty();
+  memcpy(blk_->val_, &header, sizeof(header));
+  BufferManager::LogUpdate(id_, blk_, 0, sizeof(header));
+}
+
+size_t PostingBlock::lowerBound(uint64_t packed) const {
+  return std::lower_bound(data(), data() + count(), packed) - data();
+}
+
+void PostingBlock::insert(uint64_t packed) {
+  Header h = header();
+  const size_t i = lowerBound(packed);
+  {
+    std::unique_lock latch(blk_->latch_);
+    blk_->MarkDirty();
+    memmove(positions() + i + 1, positions() + i,
+            (h.count - i) * sizeof(uint64_t));
+    positions()[i] = packed;
+    BufferManager::LogUpdate(id_, blk_, sizeof(Header) + i * sizeof(uint64_t),
+                             (h.count + 1 - i) * sizeof(uint64_t));
+  }
+  h.count++;
+  setHeader(h);
+}
+
+void PostingBlock::erase(size_t i) {
+  Header h = header();
+  {
+    std::unique_lock latch(blk_->latch_);
+    blk_->MarkDirty();
+    memmove(positions() + i, positions() + i + 1,
+            (h.count - i - 1) * sizeof(uint64_t));
+    if (i + 1 < h.count)
+      BufferManager::LogUpdate(id_, blk_,
+                               sizeof(Header) + i * sizeof(uint64_t),
+                               (h.count - i - 1) * sizeof(uint64_t));
+  }
+  h.count--;
+  setHeader(h);
+}
+
+void PostingBlock::truncate(size_t count) {
+  Header h = header();
+  h.count = count;
+  setHeader(h);
+}
+
+void PostingBlock::setNext(size_t next) {
+  Header h = header();
+  h.next = next;
+  setHeader(h);
+}
+
+PostingPage::PostingPage(size_t id) : id_(id) {
+  if (id != NEWBLOCK) {
+    blk_ = static_cast<IndexBlock *>(
+        buffer_manager.Read(id, AccessClass::Index));
+    return;
+  }
+  blk_ = static_cast<IndexBlock *>(buffer_manager.Create(id_, PageType::Index));
+  const Header header{0, 0, static_cast<uint16_t>(Config::kBlockSize), 0};
+  std::unique_lock latch(blk_->latch_);
+  blk_->MarkDirty();
+  memcpy(blk_->val_, &header, sizeof(header));
+  log(0, sizeof(header));
+}
+
+void PostingPage::release() {
+  if (blk_) blk_->Unpin();
+  blk_ = nullptr;
+}
+
+PostingPage::Header PostingPage::header() const {
+  Header header;
+  memcpy(&header, blk_->val_, sizeof(header));
+  return header;
+}
+
+PostingPage::Slot PostingPage::slot(size_t s) const {
+  Slot slot;
+  memcpy(&slot, slotAt(s), sizeof(slot));
+  return slot;
+}
+
+void PostingPage::log(size_t offset, size_t size) {
+  if (size) BufferManager::LogUpdate(id_, blk_, offset, size);
+}
+
+size_t PostingPage::freeBytes(bool new_slot) const {
+  const Header h = header();
+  const size_t slots = h.slots + (new_slot && h.used == h.slots);
+  const size_t end = sizeof(Header) + slots * sizeof(Slot);
+  return std::max<size_t>(h.heap + h.garbage, end) - end;
+}
+
+uint16_t PostingPage::allocate(size_t count, size_t slots) {
+  Header h = header();
+  const size_t size = count * sizeof(uint64_t);
+  if (h.heap < sizeof(Header) + slots * sizeof(Slot) + size) {
+    compact();
+    h = header();
+  }
+  h.heap -= size;
+  memcpy(blk_->val_, &h, sizeof(h));
+  log(0, sizeof(h));
+  return h.heap;
+}
+
+void PostingPage::compact() {
+  static thread_local char copy[Config::kBlockSize];
+  char *val = blk_->val_;
+  memcpy(copy, val, Config::kBlockSize);
+  Header h = header();
+  size_t heap = Config::kBlockSize;
+  for (size_t s = 0; s < h.slots; s++) {
+    Slot sl = slot(s);
+    if (!sl.count) continue;
+    heap -= sl.count * sizeof(uint64_t);
+    memcpy(val + heap, copy + sl.offset, sl.count * sizeof(uint64_t));
+    sl.offset = heap;
+    memcpy(slotAt(s), &sl, sizeof(sl));
+  }
+  h.heap = heap;
+  h.garbage = 0;
+  memcpy(val, &h, sizeof(h));
+  log(0, sizeof(Header) + h.slots * sizeof(Slot));
+  log(heap, Config::kBlockSize - heap);
+}
+
+size_t PostingPage::add(const uint64_t *packed, size_t count) {
+  std::unique_lock latch(blk_->latch_);
+  blk_->MarkDirty();
+  const size_t slots = header().slots;
+  size_t s = 0;
+  while (s < slots && slot(s).count) s++;
+  // a new slot is only written once the positions it may cover are moved
+  const Slot sl{allocate(count, std::max(slots, s + 1)),
+                static_cast<uint16_t>(count)};
+  Header h = header();
+  h.slots = std::max(slots, s + 1);
+  h.used++;
+  memcpy(blk_->val_, &h, sizeof(h));
+  log(0, sizeof(h));
+  memcpy(blk_->val_ + sl.offset, packed, count * sizeof(uint64_t));
+  log(sl.offset, count * sizeof(uint64_t));
+  memcpy(slotAt(s), &sl, sizeof(sl));
+  log(slotAt(s) - blk_->val_, sizeof(sl));
+  return s;
+}
+
+bool PostingPage::insert(size_t s, uint64_t packed) {
+  static thread_local uint64_t buf[kMaxShort + 1];
+  Slot sl = slot(s);
+  const size_t n = sl.count;
+  // the old list is copied, its bytes are free for the new one
+  if (sizeof(uint64_t) > freeBytes(false)) return false;
+  const uint64_t *old = list(s);
+  const size_t i = std::lower_bound(old, old + n, packed) - old;
+  std::copy(old, old + i, buf);
+  buf[i] = packed;
+  std::copy(old + i, old + n, buf + i + 1);
+
+  std::unique_lock latch(blk_->latch_);
+  blk_->MarkDirty();
+  Header h = header();
+  h.garbage += n * sizeof(uint64_t);
+  memcpy(blk_->val_, &h, sizeof(h));
+  sl.count = 0;
+  memcpy(slotAt(s), &sl, sizeof(sl));
+  sl = {allocate(n + 1, h.slots), static_cast<uint16_t>(n + 1)};
+  memcpy(blk_->val_ + sl.offset, buf, (n + 1) * sizeof(uint64_t));
+  log(sl.offset, (n + 1) * sizeof(uint64_t));
+  memcpy(slotAt(s), &sl, sizeof(sl));
+  log(slotAt(s) - blk_->val_, sizeof(sl));
+  return true;
+}
+
+void PostingPage::erase(size_t s, size_t i) {
+  std::unique_lock latch(blk_->latch_);
+  blk_->MarkDirty();
+  Slot sl = slot(s);
+  char *field = blk_->val_ + sl.offset + i * sizeof(uint64_t);
+  const size_t size = (sl.count - i - 1) * sizeof(uint64_t);
+  memmove(field, field + sizeof(uint64_t), size);
+  log(field - blk_->val_, size);
+  sl.count--;
+  memcpy(slotAt(s), &sl, sizeof(sl));
+  log(slotAt(s) - blk_->val_, sizeof(sl));
+  Header h = header();
+  h.garbage += sizeof(uint64_t);
+  memcpy(blk_->val_, &h, sizeof(h));
+  log(0, sizeof(h));
+}
+
+void PostingPage::remove(size_t s) {
+  std::unique_lock latch(blk_->latch_);
+  blk_->MarkDirty();
+  Slot sl = slot(s);
+  Header h = header();
+  h.garbage += sl.count * sizeof(uint64_t);
+  h.used--;
+  memcpy(blk_->val_, &h, sizeof(h));
+  log(0, sizeof(h));
+  sl.count = 0;
+  memcpy(slotAt(s), &sl, sizeof(sl));
+  log(slotAt(s) - blk_->val_, sizeof(sl));
+}
+
+void getBplus::switchToBlock(size_t blk_id) {
+  node_.release();  // not pinned twice
+  node_ = BplusNode(blk_id, value_type_);
+}
+
+void getBplus::newRoot() {
+  node_ = BplusNode(NodeType::LeafNode, value_type_);
+  node_.setPtr(0, {NULLBLOCK, 0});
+  root_id = node_.id();
+}
+
+void getBplus::insert(const SqlValue &val, const Position &pos) {
+  findLeaf(val);
+  if (!unique_) {
+    const size_t i = node_.lowerBound(val);
+    if (i < node_.count() && node_.compare(i, val) == 0) {
+      addPosition(i, pos);
+      return;
     }
-    element_num--;
-    updateBlock();
+  }
+  const char *key = reinterpret_cast<const char *>(&val.val);
+  const size_t i = node_.upperBound(val);
+  if (node_.hasRoom(key)) {
+    node_.insert(i, key, i, pos);
+    return;
+  }
+  split({.a = &node_, .a_keys = i, .key = key, .b = &node_, .b_key = i,
+         .a_ptrs = i, .ptr = &pos, .b_ptr = i});
+}
 
-    int minElem;
-    switch (Node_.type){
-        case NodeType::LeafNode : minElem = Config::kNodeCapacity / 2; break;
-        default: minElem = (Config::kNodeCapacity + 1) / 2;
+void getBplus::addPosition(size_t key_idx, const Position &pos) {
+  static thread_local uint64_t list[PostingPage::kMaxShort + 1];
+  const Position ptr = node_.ptr(key_idx);
+  const uint64_t packed = PostingBlock::pack(pos);
+  if (PostingPage::isShort(ptr)) {
+    PostingPage page(ptr.block_id);
+    const size_t s = ptr.offset - PostingPage::kShortList;
+    const size_t n = page.count(s);
+    if (n < PostingPage::kMaxShort && page.insert(s, packed)) return;
+    // the list moves to another page, or to blocks of its own
+    const uint64_t *old = page.list(s);
+    const size_t i = std::lower_bound(old, old + n, packed) - old;
+    std::copy(old, old + i, list);
+    list[i] = packed;
+    std::copy(old + i, old + n, list + i + 1);
+    page.remove(s);
+    releasePage(page);
+    if (n < PostingPage::kMaxShort) {
+      node_.setPtr(key_idx, addShort(key_idx, list, n + 1));
+      return;
     }
-    size_t blk_id;
-    if(Node_.type == NodeType::Root && element_num==0){
-        blk_id = Node_.pos[0].block_id;
-        memset(cur_blk_->val_, 0, Config::kBlockSize);
-        cur_blk_->dirty_ = true;
-        cur_blk_->pin_ = false;
-        updateBlock();
-
-        switchToBlock(blk_id);
-        root_id = block_id_;
-        if(Node_.type != NodeType::LeafNode) Node_.type = NodeType::Root;
-        updateBlock();
+    const PostingBlock block(list, n + 1, NULLBLOCK);
+    node_.setPtr(key_idx, {block.id(), PostingBlock::kPostingList});
+    return;
+  }
+  if (!PostingBlock::isList(ptr)) {  // the position of the only record
+    list[0] = std::min(PostingBlock::pack(ptr), packed);
+    list[1] = std::max(PostingBlock::pack(ptr), packed);
+    node_.setPtr(key_idx, addShort(key_idx, list, 2));
+    return;
+  }
+  // the last block which starts before the position
+  size_t id = ptr.block_id, next;
+  while ((next = PostingBlock(id).next()) != NULLBLOCK &&
+         PostingBlock(next).at(0) < packed)
+    id = next;
+  PostingBlock block(id);
+  if (block.count() < PostingBlock::kCapacity) {
+    block.insert(packed);
+    return;
+  }
+  // a full block is split in halves
+  const size_t half = PostingBlock::kCapacity / 2;
+  PostingBlock right(block.data() + half, PostingBlock::kCapacity - half,
+                     block.next());
+  block.truncate(half);
+  block.setNext(right.id());
+  (packed < right.at(0) ? block : right).insert(packed);
+}
+
+void getBplus::releasePage(PostingPage &page) {
+  const size_t id = page.id(), used = page.used();
+  page.release();
+  if (used) return;
+  if (id == open_page_) open_page_ = NEWBLOCK;
+  buffer_manager.Free(id);
+}
+
+Position getBplus::addShort(size_t key_idx, const uint64_t *packed,
+                            size_t count) {
+  for (const size_t j : {key_idx - 1, key_idx + 1}) {
+    if (j >= node_.count()) continue;
+    const Position ptr = node_.ptr(j);
+    if (!PostingPage::isShort(ptr)) continue;
+    PostingPage page(ptr.block_id);
+    if (page.hasRoom(count))
+      return {page.id(), PostingPage::kShortList + page.add(packed, count)};
+  }
+  if (open_page_ != NEWBLOCK) {
+    PostingPage page(open_page_);
+    if (page.hasRoom(count))
+      return {page.id(), PostingPage::kShortList + page.add(packed, count)};
+  }
+  PostingPage page(NEWBLOCK);
+  open_page_ = page.id();
+  return {page.id(), PostingPage::kShortList + page.add(packed, count)};
+}
+
+void getBplus::removePosition(size_t key_idx, const Position &pos) {
+  const Position ptr = node_.ptr(key_idx);
+  const uint64_t packed = PostingBlock::pack(pos);
+  if (PostingPage::isShort(ptr)) {
+    PostingPage page(ptr.block_id);
+    const size_t s = ptr.offset - PostingPage::kShortList;
+    const size_t n = page.count(s);
+    const uint64_t *list = page.list(s);
+    const size_t i = std::lower_bound(list, list + n, packed) - list;
+    if (i == n || list[i] != packed) return;
+    if (n > 2) {
+      page.erase(s, i);
+      return;
     }
-    else if((Node_.type==NodeType::LeafNode && element_num<minElem) || 
-            (Node_.type!=NodeType::LeafNode && element_num+1<minElem)){
-        blk_id = block_id_;   //target Node
-        size_t N_ = Node_.parent.block_id;
-        SqlValue K_;
-        int Elem_ = element_num;   //element of target Node
-        switchToBlock(N_);
-        for(i=0;i<=element_num;i++){   //find position of target Node in N_
-            if(Node_.pos[i].block_id == blk_id) break;
-        }
-        if(i==0){
-            N_ = Node_.pos[i+1].block_id;
-            K_ = Node_.elem[i];
-        }
-        else {
-            N_ = Node_.pos[i-1].block_id;
-            K_ = Node_.elem[i-1];
-        }
-        switchToBlock(N_);
-        if(element_num + Elem_ <= Config::kNodeCapacity - 1){ //merge
-            if(i==0){
-                N = N_;
-                N_ = blk_id;
-            }
-            switchToBlock(N);
-            vector<SqlValue> temp_val;
-            vector<Position> temp_pos;
-            temp_val.insert(temp_val.begin(),Node_.elem.begin(),Node_.elem.end());
-            temp_pos.insert(temp_pos.begin(),Node_.pos.begin(),Node_.pos.end());
-            switchToBlock(N_);
-            if(Node_.type!=NodeType::LeafNode){
-                Node_.elem.push_back(K_);
-                Node_.elem.insert(Node_.elem.end(),temp_val.begin(),temp_val.end());
-                Node_.pos.insert(Node_.pos.end(),temp_pos.begin(),temp_pos.end());
-            }
-            else{
-                Node_.pos.erase(Node_.pos.end()-1);
-                Node_.elem.insert(Node_.elem.end(),temp_val.begin(),temp_val.end());
-                Node_.pos.insert(Node_.pos.end(),temp_pos.begin(),temp_pos.end());
-            }
-            element_num = Node_.elem.size();
-            updateBlock();
-            delete_entry(Node_.parent.block_id, K_);
-            switchToBlock(blk_id);
-            memset(cur_blk_->val_, 0, Config::kBlockSize);
-            cur_blk_->dirty_ = true;
-            cur_blk_->pin_ = false;
-            updateBlock();
-        }
-        else{ //rearrange
-            if(i!=0){
-                if(Node_.type!=NodeType::LeafNode){
-                    SqlValue temp_K = Node_.elem[element_num-1];
-                    Position temp_p = Node_.pos[element_num];
-                    Node_.elem.erase(Node_.elem.end()-1);
-                    Node_.pos.erase(Node_.pos.end()-1);
-                    element_num--;
-                    updateBlock();
-                    switchToBlock(N);
-                    Node_.elem.insert(Node_.elem.begin(),K_);
-                    Node_.pos.insert(Node_.pos.begin(),temp_p);
-                    element_num++;
-                    updateBlock();
-                    switchToBlock(Node_.parent.block_id);
-                    for(i=0;i<element_num;i++){
-                        if(Node_.elem[i].Compare(Operator::EQ,K_)) break;
-                    }
-                    Node_.elem[i] = temp_K;
-                    updateBlock();
-                }
-                else{
-                    SqlValue temp_K = Node_.elem[element_num-1];
-                    Position temp_p = Node_.pos[element_num-1];
-                    Node_.elem.erase(Node_.elem.end()-1);
-                    Node_.pos.erase(Node_.pos.end()-2);
-                    element_num--;
-                    updateBlock();
-                    switchToBlock(N);
-                    Node_.elem.insert(Node_.elem.begin(),temp_K);
-                    Node_.pos.insert(Node_.pos.begin(),temp_p);
-                    element_num++;
-                    updateBlock();
-                    switchToBlock(Node_.parent.block_id);
-                    for(i=0;i<element_num;i++){
-                        if(Node_.elem[i].Compare(Operator::EQ,K_)) break;
-                    }
-                    Node_.elem[i] = temp_K;
-                    updateBlock();
-                }
-            }
-            else{
-                if(Node_.type!=NodeType::LeafNode){
-                    SqlValue temp_K = Node_.elem[0];
-                    Position temp_p = Node_.pos[0];
-                    Node_.elem.erase(Node_.elem.begin());
-                    Node_.pos.erase(Node_.pos.begin());
-                    element_num--;
-                    updateBlock();
-                    switchToBlock(N);
-                    Node_.elem.push_back(K_);
-                    Node_.pos.push_back(temp_p);
-                    element_num++;
-                    updateBlock();
-                    switchToBlock(Node_.parent.block_id);
-                    for(i=0;i<element_num;i++){
-                        if(Node_.elem[i].Compare(Operator::EQ,K_)) break;
-                    }
-                    Node_.elem[i] = temp_K;
-                    updateBlock();
-                }
-                else{
-                    SqlValue temp_K = Node_.elem[1];
-                    Position temp_p = Node_.pos[0];
-                    Node_.elem.erase(Node_.elem.begin());
-                    Node_.pos.erase(Node_.pos.begin());
-                    element_num--;
-                    updateBlock();
-                    switchToBlock(N);
-                    Node_.elem.push_back(K_);
-                    Node_.pos.insert(Node_.pos.end()-1,temp_p);
-                    element_num++;
-                    updateBlock();
-                    switchToBlock(Node_.parent.block_id);
-                    for(i=0;i<element_num;i++){
-                        if(Node_.elem[i].Compare(Operator::EQ,K_)) break;
-                    }
-                    Node_.elem[i] = temp_K;
-                    updateBlock();
-                }
-            }
-        }
+    // the other record is pointed to by the leaf
+    node_.setPtr(key_idx, PostingBlock::unpack(list[1 - i]));
+    page.remove(s);
+    releasePage(page);
+    return;
+  }
+
+  // the first block which ends after the position, and the one before it
+  size_t prev = NULLBLOCK, id = ptr.block_id;
+  for (;;) {
+    const PostingBlock block(id);
+    if (block.at(block.count() - 1) >= packed || block.next() == NULLBLOCK)
+      break;
+    prev = std::exchange(id, block.next());
+  }
+  PostingBlock block(id);
+  const size_t i = block.lowerBound(packed);
+  if (i == block.count() || block.at(i) != packed) return;
+  block.erase(i);
+  const size_t left = block.count(), next = block.next();
+  block.release();
+  if (left == 0) {
+    if (prev == NULLBLOCK)
+      node_.setPtr(key_idx, {next, PostingBlock::kPostingList});
+    else
+      PostingBlock(prev).setNext(next);
+    buffer_manager.Free(id);
+  }
+  // a list which got short moves to a page, not as soon as it could, so that
+  // it doesn't move back and forth
+  static thread_local uint64_t list[PostingPage::kMaxShort / 2];
+  PostingBlock head(node_.ptr(key_idx).block_id);
+  const size_t n = head.count();
+  if (head.next() != NULLBLOCK || n > PostingPage::kMaxShort / 2) return;
+  std::copy(head.data(), head.data() + n, list);
+  const size_t head_id = head.id();
+  head.release();
+  buffer_manager.Free(head_id);
+  node_.setPtr(key_idx, n == 1 ? PostingBlock::unpack(list[0])
+                               : addShort(key_idx, list, n));
+}
+
+void getBplus::collect(const Position &ptr, vector<Position> &out) {
+  if (PostingPage::isShort(ptr)) {
+    const PostingPage page(ptr.block_id);
+    const size_t s = ptr.offset - PostingPage::kShortList;
+    const uint64_t *list = page.list(s);
+    for (size_t i = 0; i < page.count(s); i++)
+      out.push_back(PostingBlock::unpack(list[i]));
+    return;
+  }
+  if (!PostingBlock::isList(ptr)) {
+    out.push_back(ptr);
+    return;
+  }
+  for (size_t id = ptr.block_id; id != NULLBLOCK;) {
+    const PostingBlock block(id);
+    for (size_t i = 0; i < block.count(); i++)
+      out.push_back(PostingBlock::unpack(block.at(i)));
+    id = block.next();
+  }
+}
+
+void getBplus::split(const Entries &entries) {
+  static thread_local char images[2][Config::kBlockSize];
+  const bool leaf = node_.isLeaf();
+  const size_t n = entries.keys(), m = splitPoint(entries, node_, !leaf);
+  // a leaf keeps the keys after the separator, an internal node moves its
+  // key m up
+  char sep[Config::kMaxStringLength];
+  if (leaf)
+    separator(entries, m, sep);
+  else
+    entries.copyKey(m, sep);
+  char low[Config::kMaxStringLength], high[Config::kMaxStringLength];
+  const bool has_low = node_.copyFence(false, low);
+  const bool has_high = node_.copyFence(true, high);
+
+  const size_t parent_id = node_.parent().block_id;
+  BplusNode right(node_.type(), value_type_);
+  BplusNode left_image(images[0], node_.type(), value_type_);
+  BplusNode right_image(images[1], node_.type(), value_type_);
+  left_image.setParent(parent_id);
+  right_image.setParent(parent_id);
+  left_image.setFences(has_low ? low : nullptr, sep);
+  right_image.setFences(sep, has_high ? high : nullptr);
+  fill(left_image, entries, 0, m);
+  fill(right_image, entries, leaf ? m : m + 1, n);
+  if (leaf) {
+    left_image.setPtr(m, {right.id(), 0});
+    right_image.setPtr(n - m, entries.ptrAt(n));
+  }
+  right.assign(right_image);
+  node_.assign(left_image);
+  if (!leaf)
+    for (size_t j = 0; j <= right.count(); j++)
+      BplusNode(right.ptr(j).block_id, value_type_).setParent(right.id());
+
+  const size_t right_id = right.id();
+  right.release();
+  insert_in_parent(node_.id(), right_id, sep);
+}
+
+void getBplus::insert_in_parent(size_t left_id, size_t right_id,
+                                const char *key) {
+  const size_t parent_id = node_.parent().block_id;
+  if (parent_id == ROOT) {
+    BplusNode root(NodeType::Root, value_type_);
+    root.setPtr(0, {left_id, 0});
+    root.insert(0, key, 1, {right_id, 0});
+    root_id = root.id();
+    root.release();
+    for (const size_t id : {left_id, right_id}) {
+      switchToBlock(id);
+      node_.setParent(root_id);
+      if (node_.type() == NodeType::Root) node_.setType(NodeType::nonLeafNode);
     }
+    return;
+  }
+
+  switchToBlock(parent_id);
+  const size_t i = node_.childIndex(left_id);
+  const Position child{right_id, 0};
+  if (node_.hasRoom(key)) {
+    node_.insert(i, key, i + 1, child);
+    return;
+  }
+  // the new child goes right after the one it is split from
+  split({.a = &node_, .a_keys = i, .key = key, .b = &node_, .b_key = i,
+         .a_ptrs = i + 1, .ptr = &child, .b_ptr = i + 1});
 }
 
-void getBplus::deleteIndexRoot() {
-    //
-    memset(cur_blk_->val_, 0, Config::kBlockSize);
-    cur_blk_->dirty_ = true;
-    cur_blk_->pin_ = false;
+size_t getBplus::findLeaf(const SqlValue &val) {
+  switchToBlock(root_id);
+  while (!node_.isLeaf())
+    switchToBlock(node_.ptr(node_.upperBound(val)).block_id);
+  return node_.id();
+}
+
+Position getBplus::findMin() {
+  switchToBlock(root_id);
+  while (!node_.isLeaf()) switchToBlock(node_.ptr(0).block_id);
+  return node_.ptr(0);
+}
+
+void getBplus::erase(const SqlValue &val, const Position &pos) {
+  findLeaf(val);
+  const size_t i = node_.lowerBound(val);
+  if (i == node_.count() || node_.compare(i, val) != 0) return;
+  const Position ptr = node_.ptr(i);
+  if (PostingBlock::isList(ptr) || PostingPage::isShort(ptr))
+    removePosition(i, pos);
+  else if (ptr == pos)
+    delete_entry(i);
+}
+
+void getBplus::delete_entry(size_t key_idx) {
+  static thread_local char images[2][Config::kBlockSize];
+  node_.erase(key_idx, node_.isLeaf() ? key_idx : key_idx + 1);
+  const size_t parent_id = node_.parent().block_id;
+  if (parent_id == ROOT) {
+    // the root with a single child is replaced by the child
+    if (!node_.isLeaf() && node_.count() == 0) {
+      const size_t old_id = node_.id();
+      switchToBlock(node_.ptr(0).block_id);
+      node_.setParent(ROOT);
+      if (!node_.isLeaf()) node_.setType(NodeType::Root);
+      root_id = node_.id();
+      buffer_manager.Free(old_id);
+    }
+    return;
+  }
+  if (!node_.underflow()) return;
+
+  // the node and its sibling on the left, or on the right for the first child
+  const size_t id = node_.id();
+  switchToBlock(parent_id);
+  const size_t i = node_.childIndex(id);
+  const size_t k = i ? i - 1 : 0;  // the key between the two
+  const size_t left_id = node_.ptr(k).block_id;
+  const size_t right_id = node_.ptr(k + 1).block_id;
+  BplusNode left(left_id, value_type_), right(right_id, value_type_);
+  const bool leaf = left.isLeaf();
+  const size_t lc = left.count();
+  // the next leaf of the left one is dropped, the key between two internal
+  // nodes comes down
+  char key[Config::kMaxStringLength];
+  node_.copyKey(k, key);
+  const Entries entries{.a = &left, .a_keys = lc,
+                        .key = leaf ? nullptr : key, .b = &right, .b_key = 0,
+                        .a_ptrs = leaf ? lc : lc + 1, .ptr = nullptr,
+                        .b_ptr = 0};
+  const size_t n = entries.keys();
+  char low[Config::kMaxStringLength], high[Config::kMaxStringLength];
+  const bool has_low = left.copyFence(false, low);
+  const bool has_high = right.copyFence(true, high);
+
+  BplusNode merged(images[0], left.type(), value_type_);
+  merged.setParent(parent_id);
+  merged.setFences(has_low ? low : nullptr, has_high ? high : nullptr);
+  if (merged.fits(entriesSize(entries, merged, 0, n))) {
+    // merge the right one into the left one
+    fill(merged, entries, 0, n);
+    if (leaf) merged.setPtr(n, entries.ptrAt(n));
+    left.assign(merged);
+    if (!leaf)
+      for (size_t j = lc + 1; j <= n; j++)
+        BplusNode(left.ptr(j).block_id, value_type_).setParent(left_id);
+    left.release();
+    right.release();
+    buffer_manager.Free(right_id);
+    delete_entry(k);
+    return;
+  }
 
+  // share the keys evenly, unless the parent has no room for their new
+  // separator, then the node is left as it is
+  const size_t m = splitPoint(entries, merged, !leaf);
+  char sep[Config::kMaxStringLength];
+  if (leaf)
+    separator(entries, m, sep);
+  else
+    entries.copyKey(m, sep);
+  if (!node_.hasRoom(sep, k)) return;
+  BplusNode left_image(images[0], left.type(), value_type_);
+  BplusNode right_image(images[1], right.type(), value_type_);
+  left_image.setParent(parent_id);
+  right_image.setParent(parent_id);
+  left_image.setFences(has_low ? low : nullptr, sep);
+  right_image.setFences(sep, has_high ? high : nullptr);
+  // each half has fences of its own, and may have a shorter prefix than the
+  // merged node
+  if (!left_image.fits(entriesSize(entries, left_image, 0, m)) ||
+      !right_image.fits(entriesSize(entries, right_image, leaf ? m : m + 1, n)))
     return;
+  fill(left_image, entries, 0, m);
+  fill(right_image, entries, leaf ? m : m + 1, n);
+  if (leaf) {
+    left_image.setPtr(m, {right_id, 0});
+    right_image.setPtr(n - m, entries.ptrAt(n));
+  }
+  left.assign(left_image);
+  right.assign(right_image);
+  node_.setKey(k, sep);
+  if (!leaf) {
+    // the children which moved to the other node
+    for (size_t j = m + 1; j <= lc; j++)
+      BplusNode(right.ptr(j - m - 1).block_id, value_type_)
+          .setParent(right_id);
+    for (size_t j = lc + 1; j <= m; j++)
+      BplusNode(left.ptr(j).block_id, value_type_).setParent(left_id);
+  }
+}
+
+void getBplus::deleteIndexRoot() {
+  vector<size_t> nodes{root_id};
+  std::set<size_t> lists;  // the blocks and the pages of the posting lists
+  for (size_t i = 0; i < nodes.size(); i++) {
+    switchToBlock(nodes[i]);
+    if (node_.isLeaf()) {
+      for (size_t j = 0; j < node_.count(); j++) {
+        const Position ptr = node_.ptr(j);
+        if (PostingPage::isShort(ptr)) lists.insert(ptr.block_id);
+        if (!PostingBlock::isList(ptr)) continue;
+        for (size_t id = ptr.block_id; id != NULLBLOCK;
+             id = PostingBlock(id).next())
+          lists.insert(id);
+      }
+      continue;
+    }
+    for (size_t j = 0; j <= node_.count(); j++)
+      nodes.push_back(node_.ptr(j).block_id);
+  }
+  releaseBlock();
+  for (auto &id : nodes) buffer_manager.Free(id);
+  for (auto &id : lists) buffer_manager.Free(id);
 }
 
 void IndexManager::Init() {}
@@ -576,8 +1326,12 @@ IndexManager::IndexManager(){
 }
 
 IndexManager::~IndexManager(){
+    if (BufferManager::ReadOnly()) return;  // the files are left as they were
     std::ofstream os(Config::kIndexFileName, std::ios::binary);
+    save(os);
+}
 
+void IndexManager::save(std::ostream &os) const {
     size_t index_count = index_blocks.size();
     os.write(reinterpret_cast<char *>(&index_count), sizeof(index_count));
 
@@ -593,59 +1347,51 @@ IndexManager::~IndexManager(){
     }
 }
 
+void IndexManager::logSnapshot() const {
+    std::ostringstream os;
+    save(os);
+    BufferManager::LogMeta(MetaKind::Index, os.view());
+}
+
+SqlValueType IndexManager::keyType(const Table &table,
+                                   const string &index_name) {
+    for (const auto &[attribute, name] : table.indexes)
+        if (name == index_name) return get<1>(table.attributes.at(attribute));
+    throw invalid_ident(("no index " + index_name).c_str());
+}
+
 bool IndexManager::CreateIndex(const Table &table, const string &index_name,
                  const string &column){
     #ifdef _indexDEBUG
     cout << "creating index..." << endl;
     #endif
 
-    if(get<2>(table.attributes.at(column)) == SpecialAttribute::None){
-        cerr << "failed to build index: the attribute may not be unique" << endl;
-        return true;
-    }
     SqlValueType p = get<1>(table.attributes.at(column));
+    const bool unique =
+        get<2>(table.attributes.at(column)) != SpecialAttribute::None;
     #ifdef _indexDEBUG
     cout << "creating newNode..." << endl;
     #endif
     
-    getBplus newTree(NEWBLOCK, p, index_name);
-    newTree.newNode(NodeType::LeafNode);
-    newTree.Node_.parent.block_id = ROOT;
-    newTree.root_id = newTree.block_id_;   //new Tree, new id, new block
-    Position temp = {NULLBLOCK, 0};
-    newTree.Node_.pos.push_back(temp);
-    newTree.updateBlock();
-    index_blocks.insert({index_name, newTree.root_id});
+    getBplus newTree(NEWBLOCK, p, unique);
+    newTree.newRoot();
     #ifdef _indexDEBUG
-    cout << "new block id: " << newTree.block_id_ << endl;
+    cout << "new block id: " << newTree.root_id << endl;
     #endif
     
     #ifdef _indexDEBUG
     cout << "inserting formal element..." << endl;
     #endif
-    //not finished yet
     size_t idx = get<0>(table.attributes.at(column));
-    size_t root_id;
-    SqlValue data;
-    Position pos;
     RecordAccessProxy rap = record_manager.getIterator(table);
     do{
         if(!rap.isCurrentSlotValid()) continue;
-        #ifdef _indexDEBUG
-        cout << "get into loop" << endl;
-        #endif
-        data = rap.extractData().values[idx];
-        pos = rap.extractPostion();
-        newTree.insert(data, pos);
-        //attention: there might be something wrong blow
-        index_blocks[column] = newTree.root_id;
-        root_id = index_blocks[column];
-        if(newTree.block_id_ != root_id) newTree.switchToBlock(root_id);
-        #ifdef _indexDEBUG
-        cout << "end of one loop" << endl;
-        #endif
+        newTree.insert(rap.extractData().values[idx], rap.extractPostion());
     } while(rap.next());
     newTree.releaseBlock();
+    index_blocks[index_name] = newTree.root_id;
+    open_pages[index_name] = newTree.open_page_;
+    logSnapshot();
     #ifdef _indexDEBUG
     cout << "finish create index" << endl;
     #endif
@@ -671,10 +1417,11 @@ bool IndexManager::PrimaryKeyIndex(const Table &table){
 
 bool IndexManager::DropIndex(const Table &table, const string &index_name){
     auto &block_id = index_blocks.at(index_name);
-    getBplus byebye(block_id, 0, index_name);
+    getBplus byebye(block_id, keyType(table, index_name));
     byebye.deleteIndexRoot();
     index_manager.index_blocks.erase(index_name);
-    byebye.releaseBlock();
+    open_pages.erase(index_name);
+    logSnapshot();
     
     return true;
 }
@@ -689,7 +1436,7 @@ void IndexManager::DropAllIndex(const Table &table){
 
 bool IndexManager::InsertKey(const Table &table,
                  const Tuple &tuple,
-                 Position &pos){
+                 const Position &pos){
     #ifdef _indexDEBUG
     cout << "starting insert..." << endl;
     #endif
@@ -702,16 +1449,25 @@ bool IndexManager::InsertKey(const Table &table,
         #ifdef _indexDEBUG
         cout << "insert into: " << attribute_name << index_name << block_id << attribute_index << attribute_type << endl;
         #endif
-        getBplus current(block_id, attribute_type, index_name);
+        auto &special = get<2>(table.attributes.at(attribute_name));
+        auto &open_page =
+            open_pages.try_emplace(index_name, NEWBLOCK).first->second;
+        getBplus current(block_id, attribute_type,
+                         special != SpecialAttribute::None);
+        current.open_page_ = open_page;
         current.insert(tuple.values[attribute_index], pos);
-        index_blocks[index_name] = current.root_id;
+        open_page = current.open_page_;
+        if (index_blocks[index_name] != current.root_id) {
+            index_blocks[index_name] = current.root_id;
+            logSnapshot();
+        }
         current.releaseBlock();
     }
     return true;
 }
 
 bool IndexManager::RemoveKey(const Table &table,
-                    const Tuple &tuple){
+                    const Tuple &tuple, const Position &pos){
     //
     for(const auto &v : table.indexes){
         auto &attribute_name = v.first;
@@ -719,13 +1475,33 @@ bool IndexManager::RemoveKey(const Table &table,
         auto &block_id = index_blocks.at(index_name);
         auto &attribute_index = get<0>(table.attributes.at(attribute_name));
         auto &attribute_type = get<1>(table.attributes.at(attribute_name));
-        getBplus current(block_id, attribute_type, index_name);
-        current.erase(tuple.values[attribute_index]);
+        auto &special = get<2>(table.attributes.at(attribute_name));
+        auto &open_page =
+            open_pages.try_emplace(index_name, NEWBLOCK).first->second;
+        getBplus current(block_id, attribute_type,
+                         special != SpecialAttribute::None);
+        current.open_page_ = open_page;
+        current.erase(tuple.values[attribute_index], pos);
+        open_page = current.open_page_;
         current.releaseBlock();
+        if (block_id != current.root_id) {  // the root has been collapsed
+            block_id = current.root_id;
+            logSnapshot();
+        }
     }
     return true;
 }
 
+bool IndexManager::Contains(const Table &table, const string &index_name,
+                            const SqlValue &val){
+    const auto it = index_blocks.find(index_name);
+    if (it == index_blocks.end() || it->second == NEWBLOCK) return false;
+    getBplus index(it->second, keyType(table, index_name));
+    index.findLeaf(val);
+    const size_t i = index.node_.lowerBound(val);
+    return i < index.node_.count() && index.node_.compare(i, val) == 0;
+}
+
 bool IndexManager::checkCondition(const Table &table, const vector<Condition> &condition){
     #ifdef _indexDEBUG
     cout << "check Condition" << endl;
@@ -766,192 +1542,73 @@ const Tuple IndexManager::extractData(const Table& table, const Position& pos){
     #ifdef _indexDEBUG
     cout << "extracting data: " << pos.block_id << " " << pos.offset << endl;
     #endif
-  Block* blk = buffer_manager.Read(pos.block_id);
-    #ifdef _indexDEBUG
-    cout << "reach the block"  << endl;
-    #endif
-  char *data = blk->val_ + pos.offset;
-  char *tmp = data;
-  int size = table.attributes.size();
-  #ifdef _indexDEBUG
-    cout << "attribute number: " << size << endl;
-    #endif
-  Tuple tuple_;
-  SqlValue t;
-  for (auto &v : table.attributes) {
-    switch (get<1>(v.second)) {
-      case static_cast<SqlValueType>(SqlValueTypeBase::Integer):
-        #ifdef _indexDEBUG
-        cout << "type : integer " << endl;
-        #endif
-        memcpy(&t.val.Integer, tmp, sizeof(t.val.Integer));
-        t.type = static_cast<SqlValueType>(SqlValueTypeBase::Integer);
-        #ifdef _indexDEBUG
-        cout << t.val.Integer << endl;
-        #endif
-        tuple_.values.push_back(t);
-        tmp += sizeof(t.val.Integer);
-        break;
-      case static_cast<SqlValueType>(SqlValueTypeBase::Float):
-        #ifdef _indexDEBUG
-        cout << "type : float " << endl;
-        #endif
-        memcpy(&t.val.Float, tmp, sizeof(t.val.Float));
-        t.type = static_cast<SqlValueType>(SqlValueTypeBase::Float);
-        #ifdef _indexDEBUG
-        cout << setprecision(2) << setiosflags(ios::fixed) << t.val.Float << endl;
-        #endif
-        tuple_.values.push_back(t);
-        tmp += sizeof(t.val.Float);
-        break;
-      default: {
-        size_t len =
-            get<1>(v.second) - static_cast<SqlValueType>(SqlValueTypeBase::String);
-            #ifdef _indexDEBUG
-        cout << "type : string " << endl;
-        #endif
-        memcpy(t.val.String, tmp, len);
-        t.type = static_cast<SqlValueType>(len);
-        #ifdef _indexDEBUG
-        cout << t.val.String << endl;
-        #endif
-        tuple_.values.push_back(t);
-        tmp += len;
-        break;
-      }
-    }
-  }
-    #ifdef _indexDEBUG
-    cout << "obtain data!" << endl;
-    #endif
-  return tuple_;
+  const auto res = record_manager.selectRecordFromPosition(table, {pos}, {});
+  return res.empty() ? table.makeEmptyTuple() : res[0];
 }
 
 vector<Tuple> IndexManager::SelectRecord(const Table &table,
                              const vector<Condition> &conditions) {
-    #ifdef _indexDEBUG
-    cout << "start selecting..." << endl;
-    #endif
     vector<Tuple> res;
     vector<Condition> good;
-    int i;
-    #ifdef _indexDEBUG
-    cout << "searching good conditions" << endl;
-    #endif
-    for(i; i<conditions.size();i++){
-        if(table.indexes.contains(conditions[i].attribute)){
-            good.push_back(conditions[i]);
-        }
-    }
+    for (const auto &c : conditions)
+        if (table.indexes.contains(c.attribute)) good.push_back(c);
     Condition perfect = good[0];
-    #ifdef _indexDEBUG
-    cout << "searching perfect condition" << endl;
-    #endif
-    for(i; i<good.size();i++){
-        if(good[i].op == Operator::EQ) {
-            perfect = good[i]; 
+    for (const auto &c : good) {
+        if (c.op == Operator::EQ) {
+            perfect = c;
             break;
         }
-        if(good[i].op < perfect.op) perfect = good[i];
+        if (c.op < perfect.op) perfect = c;
     }
     #ifdef _indexDEBUG
     cout << "find perfect: " << perfect.val.val.String << endl;
     #endif
-    getBplus index(index_blocks[perfect.attribute], perfect.val.type, table.indexes.at(perfect.attribute));
-    index.getNodeInfo();
-    index.findLeaf(perfect.val);
-    size_t blk = index.block_id_;
-    int offset;
-    for(offset=0;offset<index.element_num;offset++){
-        #ifdef _indexDEBUG
-        cout << "compare: " << index.Node_.elem[offset].val.String << endl;
-        #endif
-        if(index.Node_.elem[offset].Compare(Operator::EQ, perfect.val)) break;
-    }
-    switch(perfect.op){
-        case Operator::EQ : {
-            #ifdef _indexDEBUG
-            cout << "get equal condition" << endl;
-            #endif
-            if(judgeConditions(table, index.Node_.pos[offset], conditions))
-            res.push_back(extractData(table, index.Node_.pos[offset])); 
-            break;}
-        case Operator::GT : {
-            do{
-                index.switchToBlock(blk);
-                for(offset=0;offset<index.element_num;offset++){
-                    if(judgeConditions(table, index.Node_.pos[offset], conditions))
-                    res.push_back(extractData(table, index.Node_.pos[offset])); 
-                }
-                blk = index.Node_.pos[offset].block_id;
-            }while(blk != ROOT);
-            break;
+    getBplus index(index_blocks[table.indexes.at(perfect.attribute)],
+                   get<1>(table.attributes.at(perfect.attribute)));
+    vector<Position> positions;
+    const auto select = [&]() {
+        for (const auto &pos : positions)
+            if (judgeConditions(table, pos, conditions))
+                res.push_back(extractData(table, pos));
+        positions.clear();
+    };
+    // the records of the keys in the leaves from one to another (included)
+    const auto visit = [&](size_t blk, size_t last) {
+        while (blk != NULLBLOCK) {
+            index.switchToBlock(blk);
+            const size_t n = index.node_.count();
+            for (size_t i = 0; i < n; i++)
+                getBplus::collect(index.node_.ptr(i), positions);
+            select();
+            if (blk == last) break;
+            blk = index.node_.ptr(n).block_id;
         }
-        case Operator::GE : {
-            do{
-                index.switchToBlock(blk);
-                for(offset=0;offset<index.element_num;offset++){
-                    if(judgeConditions(table, index.Node_.pos[offset], conditions))
-                    res.push_back(extractData(table, index.Node_.pos[offset])); 
-                }
-                blk = index.Node_.pos[offset].block_id;
-            }while(blk != ROOT);
+    };
+    const size_t leaf = index.findLeaf(perfect.val);
+    switch (perfect.op) {
+        case Operator::EQ: {
+            const size_t i = index.node_.lowerBound(perfect.val);
+            if (i == index.node_.count() ||
+                index.node_.compare(i, perfect.val) != 0)
+                break;
+            getBplus::collect(index.node_.ptr(i), positions);
+            select();
             break;
         }
-        case Operator::LE : {
-            index.findMin();
-            size_t cur = index.block_id_;
-            do{
-                index.switchToBlock(cur);
-                for(offset=0;offset<index.element_num;offset++){
-                    if(judgeConditions(table, index.Node_.pos[offset], conditions))
-                    res.push_back(extractData(table, index.Node_.pos[offset])); 
-                }
-                cur = index.Node_.pos[offset].block_id;
-            }while(cur != blk);
-                index.switchToBlock(cur);
-                for(offset=0;offset<index.element_num;offset++){
-                    if(judgeConditions(table, index.Node_.pos[offset], conditions))
-                    res.push_back(extractData(table, index.Node_.pos[offset])); 
-                }
+        case Operator::GT:
+        case Operator::GE:
+            visit(leaf, NULLBLOCK);
             break;
-        }
-        case Operator::LT : {
+        case Operator::LE:
+        case Operator::LT:
             index.findMin();
-            size_t cur = index.block_id_;
-            do{
-                index.switchToBlock(cur);
-                for(offset=0;offset<index.element_num;offset++){
-                    if(judgeConditions(table, index.Node_.pos[offset], conditions))
-                    res.push_back(extractData(table, index.Node_.pos[offset])); 
-                }
-                cur = index.Node_.pos[offset].block_id;
-            }while(cur != blk);
-                index.switchToBlock(cur);
-                for(offset=0;offset<index.element_num;offset++){
-                    if(judgeConditions(table, index.Node_.pos[offset], conditions))
-                    res.push_back(extractData(table, index.Node_.pos[offset])); 
-                }
+            visit(index.node_.id(), leaf);
             break;
-        }
-        case Operator::NE : {
+        case Operator::NE:
             index.findMin();
-            size_t cur = index.block_id_;
-            do{
-                index.switchToBlock(cur);
-                for(offset=0;offset<index.element_num;offset++){
-                    if(judgeConditions(table, index.Node_.pos[offset], conditions))
-                    res.push_back(extractData(table, index.Node_.pos[offset])); 
-                }
-                cur = index.Node_.pos[offset].block_id;
-            }while(cur != ROOT);
+            visit(index.node_.id(), NULLBLOCK);
             break;
-        }
     }
-    #ifdef _indexDEBUG
-    cout << "returning selecting result   " << res[0].values[1].val.String << endl;
-    cout << (res[0].values[1].type == static_cast<SqlValueType>(SqlValueTypeBase::String)) << endl;
-    #endif
     return res;
 }
 
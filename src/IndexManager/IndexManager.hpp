@@ -2,9 +2,12 @@
 
 //#define _indexDEBUG
 
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -25,67 +28,638 @@ enum struct NodeType { Root, nonLeafNode, LeafNode };
 
 struct IndexBlock : public Block {};
 
-struct bplusNode {
-  vector<SqlValue> elem;
-  vector<Position> pos;
-  Position parent;
-  NodeType type;
+/**
+ * @brief a node of a B+ tree, viewed in place in its index block, which stays
+ * pinned as long as the view points to it. The block is a header, the
+ * pointers and the keys:
+ * - a leaf has the position of the record of each key, followed by the next
+ *   leaf ({NULLBLOCK, 0} for the last one),
+ * - an internal node has a child before each key and one after the last key,
+ *   the keys in a child are not less than the key before it and less than the
+ *   key after it.
+ * An int or a float key takes 4 bytes, in an array at a fixed offset after
+ * the pointers, so that a node holds hundreds of them.
+ *
+ * A node of char keys is a slotted page instead: each pointer has an entry
+ * with the offset and the size of the key after it, and the keys are packed
+ * at the end of the block without their trailing '\0's. The node keeps its
+ * fences, the least key it may have and the least key of the next node, and
+ * the prefix they share, which every key of the node has, is cut off the keys.
+ * The separators of the leaves are cut down to the shortest prefix which
+ * tells the keys on their two sides apart.
+ *
+ * Keys are compared in place. Each change is logged. A scratch node views an
+ * image outside the buffer, where a node is built before it replaces one.
+ */
+class BplusNode {
+ public:
+  /**
+   * @brief get the size of a key in a node, before it is shortened
+   *
+   * @param key_type the type of the keys
+   */
+  static size_t keySize(SqlValueType key_type);
+  /**
+   * @brief get the number of keys in a full node of int or float keys
+   *
+   * @param key_type the type of the keys
+   */
+  static size_t maxKeys(SqlValueType key_type);
+
+ private:
+  struct Header {
+    int32_t count;  // the number of keys
+    NodeType type;
+    Position parent;  // {ROOT, 0} for the root
+  };
+  static constexpr size_t kPtrOffset = sizeof(Header);
+  static constexpr size_t kSearchWindow = 16;  // two vectors of AVX2
+
+  // the header of a slotted node, after Header
+  struct SlotHeader {
+    uint16_t heap;     // the offset of the first byte of the keys
+    uint16_t garbage;  // the bytes of the erased keys among them
+    uint16_t prefix;   // the size of the prefix, the first bytes of low
+    uint16_t low, low_size, high, high_size;  // the fences
+  };
+  struct Slot {
+    uint16_t offset, size;
+  };
+  static constexpr uint16_t kNoFence = UINT16_MAX;  // the size of no fence
+  static constexpr size_t kEntryOffset = kPtrOffset + sizeof(SlotHeader);
+  static constexpr size_t kEntrySize = sizeof(Position) + sizeof(Slot);
+  static_assert(Config::kBlockSize <= UINT16_MAX,
+                "the offsets in a block don't fit in a slot");
+  static_assert(Config::kBlockSize - kEntryOffset >=
+                    4 * kEntrySize + 5 * Config::kMaxStringLength,
+                "a node of the largest keys can't be split");
+
+  size_t id_ = NULLBLOCK;
+  IndexBlock *blk_ = nullptr;  // nullptr for a scratch node
+  char *val_ = nullptr;        // the bytes of the node
+  SqlValueType key_type_ = 0;
+  bool slotted_ = false;
+  size_t key_size_ = 0;
+  size_t max_keys_ = 0;     // of a node which isn't slotted
+  size_t key_offset_ = 0;   // after the pointers of a full node
+  size_t ptr_offset_ = 0;   // of the first pointer
+  size_t ptr_stride_ = 0;   // between two pointers
+
+  BplusNode(SqlValueType key_type, char *val);
+  Header header() const;
+  SlotHeader slotHeader() const;
+  Slot slot(size_t i) const;
+  char *ptrAt(size_t i) const { return val_ + ptr_offset_ + i * ptr_stride_; }
+  char *keyAt(size_t i) const {
+    return val_ + key_offset_ + i * key_size_;
+  }
+  char *slotAt(size_t i) const { return ptrAt(i) + sizeof(Position); }
+  /**
+   * @brief get the size of a key in a slotted node
+   *
+   * @param key the key, it has the prefix of the node
+   * @param prefix the size of the prefix
+   */
+  size_t storedSize(const char *key, size_t prefix) const;
+  /**
+   * @brief make the node empty
+   */
+  void clear(NodeType type);
+  /**
+   * @brief put the bytes of a key before the other keys of a slotted node,
+   * which is compacted if they don't fit (CAUTION: call it with the latch of
+   * the block held exclusively)
+   *
+   * @param reserve the bytes kept free for the entries besides them
+   * @return the offset of the bytes
+   */
+  uint16_t putBytes(const char *bytes, size_t size, size_t reserve);
+  /**
+   * @brief move the keys of a slotted node to the end of the block, so that
+   * the bytes of the erased keys are free (CAUTION: call it with the latch of
+   * the block held exclusively)
+   */
+  void compact();
+  /**
+   * @brief latch the block exclusively and mark it dirty before it is
+   * changed, nothing is latched for a scratch node
+   */
+  std::unique_lock<std::shared_mutex> modify();
+  /**
+   * @brief log some bytes of the node after they are changed, unless it is a
+   * scratch node (CAUTION: call it with the latch of the block held
+   * exclusively)
+   */
+  void logRange(const char *begin, const char *end);
+  /**
+   * @brief get the index of the first key which isn't before a value, i.e.
+   * not less than it, or greater than it if kUpper
+   */
+  template <bool kUpper>
+  size_t search(const SqlValue &val) const;
+  /**
+   * @brief search the int or float keys: a binary search, without branches,
+   * narrows them down to kSearchWindow keys, which are compared with the
+   * value a vector at a time
+   */
+  template <bool kUpper, typename T>
+  size_t searchNumbers(T val) const;
+  /**
+   * @brief search the keys of a slotted node: the prefix is compared once,
+   * then a binary search compares the rest of the keys
+   */
+  template <bool kUpper>
+  size_t searchSlots(const char *val) const;
+
+ public:
+  BplusNode() = default;
+  /**
+   * @brief read and pin a node
+   *
+   * @param id the id of its block
+   * @param key_type the type of the keys
+   */
+  BplusNode(size_t id, SqlValueType key_type);
+  /**
+   * @brief create an empty node, pinned
+   *
+   * @param type the type of the node
+   * @param key_type the type of the keys
+   */
+  BplusNode(NodeType type, SqlValueType key_type);
+  /**
+   * @brief create an empty scratch node
+   *
+   * @param image Config::kBlockSize bytes where the node is built
+   * @param type the type of the node
+   * @param key_type the type of the keys
+   */
+  BplusNode(char *image, NodeType type, SqlValueType key_type);
+  BplusNode(const BplusNode &) = delete;
+  BplusNode(BplusNode &&other) noexcept;
+  BplusNode &operator=(const BplusNode &) = delete;
+  BplusNode &operator=(BplusNode &&other) noexcept;
+  ~BplusNode() { release(); }
+
+  size_t keySize() const { return key_size_; }
+  bool slotted() const { return slotted_; }
+  /**
+   * @brief unpin the node, the view points to nothing afterwards
+   */
+  void release();
+  size_t id() const { return id_; }
+  size_t count() const { return header().count; }
+  NodeType type() const { return header().type; }
+  bool isLeaf() const { return type() == NodeType::LeafNode; }
+  Position parent() const { return header().parent; }
+  Position ptr(size_t i) const;
+  /**
+   * @brief copy a key, the bytes after it up to keySize() are '\0's
+   *
+   * @param i the index of the key
+   * @param key Config::kMaxStringLength bytes
+   */
+  void copyKey(size_t i, char *key) const;
+  /**
+   * @brief get the size of a key without its trailing '\0's, for a slotted
+   * node, or keySize()
+   */
+  size_t keyLength(size_t i) const;
+  /**
+   * @brief copy a fence of a slotted node, like copyKey
+   *
+   * @param high the high fence, or the low one
+   * @return false if the node has no such fence: it is the first or the last
+   * one of its level
+   */
+  bool copyFence(bool high, char *key) const;
+  /**
+   * @brief get the size of the prefix cut off the keys
+   */
+  size_t prefixSize() const { return slotted_ ? slotHeader().prefix : 0; }
+  /**
+   * @brief compare a key with a value
+   *
+   * @return < 0, 0 or > 0 if the key is less than, equal to or greater than
+   * the value
+   */
+  int compare(size_t i, const SqlValue &val) const;
+  /**
+   * @brief get the index of the first key which is not less than a value
+   */
+  size_t lowerBound(const SqlValue &val) const;
+  /**
+   * @brief get the index of the first key which is greater than a value
+   */
+  size_t upperBound(const SqlValue &val) const;
+  /**
+   * @brief get the index of the pointer to a child
+   */
+  size_t childIndex(size_t child_id) const;
+  /**
+   * @brief whether a key fits in the node
+   *
+   * @param key the key, it has the prefix of the node
+   * @param replaced the index of a key it replaces, if any
+   */
+  bool hasRoom(const char *key, size_t replaced = SIZE_MAX) const;
+  /**
+   * @brief get the space a key and its pointer take in the node
+   *
+   * @param length the size of the key without its trailing '\0's
+   */
+  size_t entrySize(size_t length) const {
+    return slotted_ ? kEntrySize + length - prefixSize()
+                    : sizeof(Position) + key_size_;
+  }
+  /**
+   * @brief whether some keys fit in the node, which should be empty, besides
+   * its fences
+   *
+   * @param size the space they take (see entrySize)
+   */
+  bool fits(size_t size) const;
+  /**
+   * @brief whether the node is less than half full, so that it is merged or
+   * refilled unless it is the root
+   */
+  bool underflow() const;
+
+  void setType(NodeType type);
+  void setParent(size_t parent_id);
+  void setPtr(size_t i, const Position &ptr);
+  /**
+   * @brief replace a key, which should have room (see hasRoom)
+   */
+  void setKey(size_t i, const char *key);
+  /**
+   * @brief set the fences of a slotted node, which should be empty, and the
+   * prefix they share
+   *
+   * @param low the low fence, nullptr if there is none
+   * @param high the high fence, nullptr if there is none
+   */
+  void setFences(const char *low, const char *high);
+  /**
+   * @brief insert a key and a pointer, the keys and the pointers after them
+   * are shifted; the key should have room (see hasRoom)
+   *
+   * @param key_idx the index of the key
+   * @param key the key
+   * @param ptr_idx the index of the pointer: key_idx in a leaf, key_idx or
+   * key_idx + 1 in an internal node
+   * @param ptr the pointer
+   */
+  void insert(size_t key_idx, const char *key, size_t ptr_idx,
+              const Position &ptr);
+  /**
+   * @brief erase a key and a pointer, the keys and the pointers after them are
+   * shifted
+   */
+  void erase(size_t key_idx, size_t ptr_idx);
+  /**
+   * @brief replace the node with a scratch node, keeping its id
+   */
+  void assign(const BplusNode &image);
 };
 
+/**
+ * @brief a block of a long posting list. The posting list of a key of a
+ * non-unique index has the positions of the records with the key when there
+ * are more than one, sorted and packed into 8 bytes each. A short list shares
+ * a PostingPage with other lists, a list longer than PostingPage::kMaxShort
+ * positions has a chain of blocks of its own, in the order of their positions.
+ * The leaf has {id, kPostingList} for the first block instead of the position
+ * of a record. The block stays pinned as long as the view points to it.
+ */
+class PostingBlock {
+  struct Header {
+    uint32_t count;  // the number of positions
+    uint32_t reserved;
+    size_t next;  // NULLBLOCK for the last block
+  };
+
+  size_t id_ = NULLBLOCK;
+  IndexBlock *blk_ = nullptr;
+
+  uint64_t *positions() {
+    return reinterpret_cast<uint64_t *>(blk_->val_ + sizeof(Header));
+  }
+  Header header() const;
+  void setHeader(const Header &header);
+
+ public:
+  static constexpr size_t kPostingList = SIZE_MAX;
+  static constexpr size_t kCapacity =
+      (Config::kBlockSize - sizeof(Header)) / sizeof(uint64_t);
+  static_assert(Config::kBlockSize <= UINT16_MAX,
+                "the offset of a record doesn't fit in a packed position");
+
+  static uint64_t pack(const Position &pos) {
+    return static_cast<uint64_t>(pos.block_id) << 16 | pos.offset;
+  }
+  static Position unpack(uint64_t packed) {
+    return {static_cast<size_t>(packed >> 16),
+            static_cast<size_t>(packed & UINT16_MAX)};
+  }
+  static bool isList(const Position &ptr) {
+    return ptr.offset == kPostingList;
+  }
+
+  /**
+   * @brief read and pin a block
+   *
+   * @param id the id of the block
+   */
+  explicit PostingBlock(size_t id);
+  /**
+   * @brief create a block, pinned
+   *
+   * @param packed the sorted positions in it
+   * @param count the number of the positions
+   * @param next the block after it
+   */
+  PostingBlock(const uint64_t *packed, size_t count, size_t next);
+  PostingBlock(const PostingBlock &) = delete;
+  PostingBlock &operator=(const PostingBlock &) = delete;
+  ~PostingBlock() { release(); }
+
+  void release();
+  size_t id() const { return id_; }
+  size_t count() const { return header().count; }
+  size_t next() const { return header().next; }
+  const uint64_t *data() const {
+    return reinterpret_cast<const uint64_t *>(blk_->val_ + sizeof(Header));
+  }
+  uint64_t at(size_t i) const { return data()[i]; }
+  /**
+   * @brief get the index of the first position which is not less than one
+   */
+  size_t lowerBound(uint64_t packed) const;
+  /**
+   * @brief insert a position in order, the block should have room for it
+   */
+  void insert(uint64_t packed);
+  void erase(size_t i);
+  /**
+   * @brief drop the positions after the first ones
+   */
+  void truncate(size_t count);
+  void setNext(size_t next);
+};
+
+/**
+ * @brief a page of short posting lists (see PostingBlock): each list has a
+ * slot with the offset and the number of its positions, which are packed at
+ * the end of the page. A list is moved to the top of them when it grows, the
+ * page is compacted when the space they leave is needed. The leaf has
+ * {id, kShortList + slot} for a short list. The page stays pinned as long as
+ * the view points to it.
+ */
+class PostingPage {
+  struct Header {
+    uint16_t slots;    // the slots in the directory, used or free
+    uint16_t used;     // the slots with a list
+    uint16_t heap;     // the offset of the first position
+    uint16_t garbage;  // the bytes of the moved lists among the positions
+  };
+  struct Slot {
+    uint16_t offset, count;  // count 0 for a free slot
+  };
+
+  size_t id_ = NULLBLOCK;
+  IndexBlock *blk_ = nullptr;
+
+  Header header() const;
+  Slot slot(size_t s) const;
+  char *slotAt(size_t s) const {
+    return blk_->val_ + sizeof(Header) + s * sizeof(Slot);
+  }
+  /**
+   * @brief get the number of free bytes, the moved lists included
+   *
+   * @param new_slot whether a slot is added to the directory
+   */
+  size_t freeBytes(bool new_slot) const;
+  /**
+   * @brief make room for some positions before the others, the page is
+   * compacted if they don't fit (CAUTION: call it with the latch of the block
+   * held exclusively)
+   *
+   * @param slots the number of slots in the directory afterwards
+   * @return the offset of the positions
+   */
+  uint16_t allocate(size_t count, size_t slots);
+  void compact();
+  void log(size_t offset, size_t size);
+
+ public:
+  static constexpr size_t kShortList = size_t{1} << 32;
+  static constexpr size_t kMaxShort = PostingBlock::kCapacity / 4;
+
+  static bool isShort(const Position &ptr) {
+    return ptr.offset >= kShortList && ptr.offset != PostingBlock::kPostingList;
+  }
+
+  /**
+   * @brief read and pin a page, or create an empty one
+   *
+   * @param id the id of the page, NEWBLOCK for a new one
+   */
+  explicit PostingPage(size_t id);
+  PostingPage(const PostingPage &) = delete;
+  PostingPage &operator=(const PostingPage &) = delete;
+  ~PostingPage() { release(); }
+
+  void release();
+  size_t id() const { return id_; }
+  size_t used() const { return header().used; }
+  size_t count(size_t s) const { return slot(s).count; }
+  const uint64_t *list(size_t s) const {
+    return reinterpret_cast<const uint64_t *>(blk_->val_ + slot(s).offset);
+  }
+  /**
+   * @brief whether a list of some positions fits in the page
+   */
+  bool hasRoom(size_t count) const {
+    return count * sizeof(uint64_t) <= freeBytes(true);
+  }
+  /**
+   * @brief add a list, it should have room (see hasRoom)
+   *
+   * @param packed the sorted positions
+   * @param count the number of positions
+   * @return the slot of the list
+   */
+  size_t add(const uint64_t *packed, size_t count);
+  /**
+   * @brief insert a position into a list in order
+   *
+   * @return false if the list doesn't fit in the page with it
+   */
+  bool insert(size_t s, uint64_t packed);
+  void erase(size_t s, size_t i);
+  /**
+   * @brief remove a list, its slot is free afterwards
+   */
+  void remove(size_t s);
+};
+
+/**
+ * @brief the keys and the pointers of one or two nodes one after another,
+ * with a key or a pointer between them, which are split among new nodes
+ */
+struct Entries;
+
+/**
+ * @brief a B+ tree of an index, its nodes are visited one at a time through
+ * node_, a lookup or an insert allocates nothing and copies no node
+ */
 struct getBplus {
-  size_t block_id_;
-  int element_num;
-  struct bplusNode Node_;
-  char *data_;
-  IndexBlock *cur_blk_;
-  SqlValueType value_type_;
-  string index_name;
   size_t root_id;
+  SqlValueType value_type_;
+  bool unique_;     // whether a key has a single record, or a posting list
+  BplusNode node_;  // the current node
+  // the page which the short lists go to when the pages of the keys next to
+  // them are full, NEWBLOCK if there is none
+  size_t open_page_ = NEWBLOCK;
 
-  getBplus(size_t blk_id, SqlValueType p, string n);
+  getBplus(size_t root, SqlValueType p, bool unique = true)
+      : root_id(root), value_type_(p), unique_(unique) {}
+  getBplus(const getBplus &) = delete;
+  getBplus &operator=(const getBplus &) = delete;
+
+  /**
+   * @brief unpin the current node
+   * */
+  void releaseBlock() { node_.release(); }
+
+  void switchToBlock(size_t blk_id);
 
-  void releaseBlock();
+  /**
+   * @brief create the root of an empty tree, it is the current node
+   * */
+  void newRoot();
 
-  const bplusNode &getNodeInfo();
+  /**
+   * @brief insert ONE value into index, a value already in a non-unique index
+   * gets the position in its posting list
+   * */
+  void insert(const SqlValue &val, const Position &pos);
 
-  void newNode(NodeType t);
+  /**
+   * @brief add a position to the records of a key of the current leaf, the
+   * key gets a posting list if it has a single record
+   *
+   * @param key_idx the index of the key
+   * @param pos the position of the record
+   * */
+  void addPosition(size_t key_idx, const Position &pos);
 
-  void switchToBlock(size_t blk_id);
+  /**
+   * @brief remove a position from the posting list of a key of the current
+   * leaf, the last position left goes back into the leaf
+   *
+   * @param key_idx the index of the key
+   * @param pos the position of the record
+   * */
+  void removePosition(size_t key_idx, const Position &pos);
 
-  void updateBlock();
+  /**
+   * @brief unpin a page of short lists, it is freed if it has none
+   * */
+  void releasePage(PostingPage &page);
 
   /**
-   * @brief insert ONE value into index
-   * the cur_block_ should be set to ROOT before insert()
+   * @brief put a short posting list of a key of the current leaf into a page,
+   * the page of a key next to it or the open page if it has room
+   *
+   * @param key_idx the index of the key
+   * @param packed the sorted positions
+   * @param count the number of positions, at most PostingPage::kMaxShort
+   * @return the pointer of the key
    * */
-  void insert(SqlValue val, Position pos);
+  Position addShort(size_t key_idx, const uint64_t *packed, size_t count);
 
-  void splitLeaf();
+  /**
+   * @brief get the positions of the records of a key
+   *
+   * @param ptr the pointer of the key in its leaf
+   * @param out the positions are appended to it
+   * */
+  static void collect(const Position &ptr, vector<Position> &out);
 
   /**
-   * the cur_Node_ should be set to newNode
+   * @brief split the current node, which is full, with a new key: the first
+   * half of its keys stay, the others move to a new node, which is linked to
+   * their parent
+   *
+   * @param entries the keys and the pointers of the node with the new ones
    * */
-  void insert_in_parent(size_t old_id, size_t new_id, SqlValue k);
+  void split(const Entries &entries);
 
-  size_t findLeaf(SqlValue val);
+  /**
+   * @brief link a node split from the current one to their parent, which is
+   * split as well if it is full
+   *
+   * @param left_id the current node
+   * @param right_id the node split from it
+   * @param key the separator of the two nodes
+   * */
+  void insert_in_parent(size_t left_id, size_t right_id, const char *key);
 
-  Position find(SqlValue val);
+  /**
+   * @brief go down from the root to the leaf where a value belongs, it is the
+   * current node
+   * */
+  size_t findLeaf(const SqlValue &val);
 
+  /**
+   * @brief go down to the first leaf, it is the current node
+   * */
   Position findMin();
 
   /**
-   * @brief delete ONE key in the index at one time
-   * please set cur_blk_ to the rootNode before erase
+   * @brief delete the position of ONE record of a key in the index, the key
+   * is erased with its last record
    * */
-  void erase(SqlValue val);
+  void erase(const SqlValue &val, const Position &pos);
 
-  void delete_entry(size_t N, SqlValue K);
+  /**
+   * @brief erase a key of the current node and its pointer, the node is
+   * merged with a sibling, or shares their keys evenly with it, if it gets
+   * too small
+   *
+   * @param key_idx the index of the key
+   * */
+  void delete_entry(size_t key_idx);
 
+  /**
+   * @brief free every node of the tree
+   * */
   void deleteIndexRoot();
 };
 
 class IndexManager {
   unordered_map<std::string, size_t> index_blocks;
+  // the open page of the short posting lists of each index (see getBplus), it
+  // isn't saved
+  unordered_map<std::string, size_t> open_pages;
+
+  /**
+   * @brief write the roots of the indexes as they are stored in the file
+   */
+  void save(std::ostream &os) const;
+
+  /**
+   * @brief log a snapshot of the roots of the indexes after they are changed
+   */
+  void logSnapshot() const;
+
+  /**
+   * @brief get the type of the keys of an index, i.e. of its attribute
+   */
+  static SqlValueType keyType(const Table &table, const string &index_name);
 
  public:
   /**
@@ -103,7 +677,8 @@ class IndexManager {
   ~IndexManager();
 
   /**
-   * @brief Create a new index
+   * @brief Create a new index, the attribute may have duplicate values unless
+   * it is unique
    *
    * @param table the table on which we build index
    * @param index_name the name of the index itself
@@ -143,15 +718,28 @@ class IndexManager {
    * @param attributes the key value
    * @param pos the position of the data
    */
-  bool InsertKey(const Table &table, const Tuple &tuple, Position &pos);
+  bool InsertKey(const Table &table, const Tuple &tuple, const Position &pos);
 
   /**
-   * @brief delete a key from an index
+   * @brief delete the keys of a record from the indexes
    *
    * @param table the table with the element to be delete
-   * @param attributes the key value
+   * @param tuple the record
+   * @param pos the position of the record, the other records with the same
+   * key stay in a non-unique index
+   */
+  bool RemoveKey(const Table &table, const Tuple &tuple, const Position &pos);
+
+  /**
+   * @brief whether an index has a key, used to enforce the uniqueness of an
+   * indexed attribute without scanning the table
+   *
+   * @param table the table with the index
+   * @param index_name the name of the index
+   * @param val the key value
    */
-  bool RemoveKey(const Table &table, const Tuple &tuple);
+  bool Contains(const Table &table, const string &index_name,
+                const SqlValue &val);
 
   /**
    * @brief check whether the index can be used in these conditions
@@ -1,4 +1,5 @@
 #include <map>
+#include <set>
 #include <vector>
 
 #include "BufferManager.hpp"
@@ -7,7 +8,10 @@
 #include "RecordManager.hpp"
 using std::make_tuple;
 
-static map<tuple<string, string>, std::map<SqlValue, Position>> idx;
+// the positions of the records of each key, more than one for a duplicate key
+// of a non-unique index
+using PostingList = std::set<Position>;
+static map<tuple<string, string>, std::map<SqlValue, PostingList>> idx;
 IndexManager index_manager;
 
 void IndexManager::Init() {
@@ -32,14 +36,14 @@ IndexManager::~IndexManager() {}
 bool IndexManager::CreateIndex(const Table &table, const string &index_name,
                                const string &column) {
   idx[make_tuple(table.table_name, index_name)] =
-      std::map<SqlValue, Position>{};
+      std::map<SqlValue, PostingList>{};
   auto &s = idx[make_tuple(table.table_name, index_name)];
 
   const auto index = get<0>(table.attributes.at(column));
   RecordAccessProxy rap = record_manager.getIterator(table);
   do {
     if (!rap.isCurrentSlotValid()) continue;
-    s[rap.extractData().values[index]] = rap.extractPostion();
+    s[rap.extractData().values[index]].insert(rap.extractPostion());
   } while (rap.next());
   return true;
 }
@@ -73,28 +77,38 @@ bool IndexManager::DropIndex(const Table &table, const string &index_name) {
 }
 
 bool IndexManager::InsertKey(const Table &table, const Tuple &tuple,
-                             Position &pos) {
+                             const Position &pos) {
   for (const auto &v : table.indexes) {
     const auto &attribute_name = v.first;
     const auto &attribute_index = get<0>(table.attributes.at(attribute_name));
     const auto &index_name = v.second;
-    idx[make_tuple(table.table_name, index_name)]
-       [tuple.values[attribute_index]] = pos;
+    auto &s = idx[make_tuple(table.table_name, index_name)];
+    s[tuple.values[attribute_index]].insert(pos);
   }
   return true;
 }
 
-bool IndexManager::RemoveKey(const Table &table, const Tuple &tuple) {
+bool IndexManager::RemoveKey(const Table &table, const Tuple &tuple,
+                             const Position &pos) {
   for (const auto &v : table.indexes) {
     const auto &attribute_name = v.first;
     const auto &attribute_index = get<0>(table.attributes.at(attribute_name));
     const auto &index_name = v.second;
-    idx[make_tuple(table.table_name, index_name)].erase(
-        tuple.values[attribute_index]);
+    auto &s = idx[make_tuple(table.table_name, index_name)];
+    const auto it = s.find(tuple.values[attribute_index]);
+    if (it == s.end()) continue;
+    it->second.erase(pos);
+    if (it->second.empty()) s.erase(it);
   }
   return true;
 }
 
+bool IndexManager::Contains(const Table &table, const string &index_name,
+                            const SqlValue &val) {
+  const auto it = idx.find(make_tuple(table.table_name, index_name));
+  return it != idx.end() && it->second.contains(val);
+}
+
 bool IndexManager::checkCondition(const Table &table,
                                   const vector<Condition> &condition) {
   for (const auto &c : condition) {
@@ -115,7 +129,8 @@ vector<Tuple> IndexManager::SelectRecord(const Table &table,
         const auto &index_name = table.indexes.at(c.attribute);
         const auto &s = idx[make_tuple(table.table_name, index_name)];
         const auto &it = s.find(c.val);
-        if (it != s.end()) ret.push_back(it->second);
+        if (it != s.end())
+          ret.insert(ret.end(), it->second.begin(), it->second.end());
         break;
       }
       case Operator::GT: {
@@ -123,7 +138,7 @@ vector<Tuple> IndexManager::SelectRecord(const Table &table,
         const auto &s = idx[make_tuple(table.table_name, index_name)];
         auto it = s.upper_bound(c.val);
         while (it != s.end()) {
-          ret.push_back(it->second);
+          ret.insert(ret.end(), it->second.begin(), it->second.end());
           it++;
         }
         break;
@@ -133,7 +148,7 @@ vector<Tuple> IndexManager::SelectRecord(const Table &table,
         const auto &s = idx[make_tuple(table.table_name, index_name)];
         auto it = s.lower_bound(c.val);
         while (it != s.end()) {
-          ret.push_back(it->second);
+          ret.insert(ret.end(), it->second.begin(), it->second.end());
           it++;
         }
         break;
@@ -143,7 +158,7 @@ vector<Tuple> IndexManager::SelectRecord(const Table &table,
         const auto &s = idx[make_tuple(table.table_name, index_name)];
         for (auto &it : s) {
           if (c.val == it.first || c.val < it.first) break;
-          ret.push_back(it.second);
+          ret.insert(ret.end(), it.second.begin(), it.second.end());
         }
         break;
       }
@@ -152,7 +167,7 @@ vector<Tuple> IndexManager::SelectRecord(const Table &table,
         const auto &s = idx[make_tuple(table.table_name, index_name)];
         for (auto &it : s) {
           if (c.val < it.first) break;
-          ret.push_back(it.second);
+          ret.insert(ret.end(), it.second.begin(), it.second.end());
         }
         break;
       }
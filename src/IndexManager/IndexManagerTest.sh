@@ -0,0 +1,51 @@
+#!/bin/sh
+# Delete most of the records of a table with a unique char(64) index, whose
+# keys have different lengths and prefixes, so that the B+ tree nodes are
+# merged and refilled, then check that the index still finds the others.
+#
+# usage: IndexManagerTest.sh <MiniSQL binary> [keys]
+set -e
+bin=$(realpath "$1")
+n=${2:-1500}
+kept=$((n / 10))
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+mkdir .MiniSQL
+
+awk -v n="$n" -v kept="$kept" 'BEGIN {
+  digits = "abcdefghijklmnopqrstuvwxyz0123456789"
+  split("1 2 3 5 8 20 40 63 64", lengths, " ")
+  pad = sprintf("%50s", ""); gsub(/ /, "x", pad)
+  prefixes[0] = ""
+  prefixes[1] = "commonprefix/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/"
+  prefixes[2] = pad
+  print "create table t (id int, name char(64) unique, primary key (id));"
+  print "create index tn on t (name);"
+  for (i = 0; i < n; i++) {
+    # a unique number in base 36, padded to a pseudo-random length
+    x = (i * 7919 + 13) % 1000003
+    len = lengths[(i * 5) % 9 + 1]
+    key = ""
+    for (v = x; v > 0 || key == ""; v = int(v / 36))
+      key = key substr(digits, v % 36 + 1, 1)
+    while (length(key) < len)
+      key = key substr(digits, (i + length(key)) % 36 + 1, 1)
+    key = substr(prefixes[i % 3] key, 1, 64)
+    printf "insert into t values (%d, '\''%s'\'');\n", i, key
+  }
+  # the records are deleted one by one in a scattered order
+  for (i = 0; i < n; i++) {
+    id = (i * 7 + 3) % n
+    if (id >= kept) printf "delete from t where id = %d;\n", id
+  }
+}' > build.sql
+echo "select * from t where name < 'n';" > index.sql
+echo "select * from t where name >= 'n';" >> index.sql
+echo "select * from t;" > scan.sql
+
+"$bin" build.sql > /dev/null
+by_index=$("$bin" index.sql | tr -d '\000' | grep -a -c '^[0-9]' || true)
+by_scan=$("$bin" scan.sql | tr -d '\000' | grep -a -c '^[0-9]' || true)
+echo "records: $kept, found by the index: $by_index, by a scan: $by_scan"
+[ "$by_index" -eq "$kept" ] && [ "$by_scan" -eq "$kept" ]
@@ -93,6 +93,12 @@ void Interpreter::interpret() {
     } catch (const invalid_index_attribute &err) {
       cerr << ANSI_COLOR_RED "invalid attribute for indexing: " ANSI_COLOR_RESET
            << err.what() << endl;
+    } catch (const read_only_error &err) {
+      cerr << ANSI_COLOR_RED "read-only: " ANSI_COLOR_RESET << err.what()
+           << endl;
+    } catch (const corrupt_page_error &err) {
+      cerr << ANSI_COLOR_RED "corrupted: " ANSI_COLOR_RESET << err.what()
+           << endl;
     }
     showAffected();
     if (need_quit) break;
@@ -150,6 +156,14 @@ tuple<bool, size_t> Interpreter::interpretFile(const path &filename) {
       cerr << ANSI_COLOR_RED "invalid attribute for indexing: " ANSI_COLOR_RESET
            << err.what() << endl;
       break;
+    } catch (const read_only_error &err) {
+      cerr << ANSI_COLOR_RED "read-only: " ANSI_COLOR_RESET << err.what()
+           << endl;
+      break;
+    } catch (const corrupt_page_error &err) {
+      cerr << ANSI_COLOR_RED "corrupted: " ANSI_COLOR_RESET << err.what()
+           << endl;
+      break;
     }
     if (need_quit || interrupt) break;
     skipSpace();
@@ -497,12 +511,27 @@ void Interpreter::parseCreateTable() {
   expect("("sv);
   parseAttributeList();
   expect(")"sv);
+  auto layout = TableLayout::Row;
+  if (peek("using")) {
+    skip("using");
+    if (peek("pax")) {
+      skip("pax");
+      layout = TableLayout::Pax;
+    } else if (peek("row")) {
+      skip("row");
+    } else {
+      cerr << "expect a valid table layout among " ANSI_COLOR_GREEN
+              "[row, pax]" ANSI_COLOR_RESET
+           << endl;
+      throw syntax_error("invalid table layout");
+    }
+  }
   parseStatEnd();
 #ifdef _INTERPRETER_DEBUG
   cout << "DEBUG: create a table named `" << table_name.sv << "`" << endl;
 #endif
 
-  CreateTable(string(table_name.sv), cur_attributes);
+  CreateTable(string(table_name.sv), cur_attributes, layout);
 }
 
 void Interpreter::parseCreateIndex() {
@@ -523,6 +552,7 @@ void Interpreter::parseCreateIndex() {
        << indexed_column_name.sv << "` named `" << index_name.sv << "`" << endl;
 #endif
 
+  last_insert_table_name.clear();  // the unique attributes to scan change
   CreateIndex(string(table_name.sv), string(index_name.sv),  string(indexed_column_name.sv));
 }
 
@@ -553,9 +583,25 @@ void Interpreter::parseDropIndex() {
   cout << "DEBUG: drop a index named `" << index_name.sv << "`" << endl;
 #endif
 
+  last_insert_table_name.clear();
   DropIndex(string(table_name.sv), string(index_name.sv));
 }
 
+void Interpreter::parseVacuum() {
+  expect("vacuum"sv);
+  parseId();
+  table_name = cur_tok;
+  parseStatEnd();
+#ifdef _INTERPRETER_DEBUG
+  cout << "DEBUG: vacuum a table named `" << table_name.sv << "`" << endl;
+#endif
+
+  const auto stats = Vacuum(string(table_name.sv));
+  std::cout << ANSI_COLOR_CYAN << stats.released
+            << ANSI_COLOR_RESET " blocks released" << std::endl;
+  addAffected(stats.moved);
+}
+
 void Interpreter::parseExec() {
   expect("execfile");
   skipSpace();
@@ -727,16 +773,18 @@ void Interpreter::parseInsertStat() {
   }
   if (!not_changed) {
     need_unique.clear();
-    for (auto &[_1, value] : last_table->attributes) {
-      auto &[idx, type, special, offset] = value;
-      if (special >= SpecialAttribute::PrimaryKey) {
+    for (auto &[name, value] : last_table->attributes) {
+      auto &[idx, type, special, _1] = value;
+      // an indexed attribute is checked by InsertFast through its index
+      if (special >= SpecialAttribute::PrimaryKey &&
+          !last_table->indexes.contains(name)) {
         size_t len = type;
         if (type >= static_cast<SqlValueType>(SqlValueTypeBase::String))
           len -= static_cast<SqlValueType>(SqlValueTypeBase::String);
         else
           len = sizeof(int);
         need_unique.push_back(
-            {reinterpret_cast<const char *>(&tp.values[idx].val), len, offset});
+            {reinterpret_cast<const char *>(&tp.values[idx].val), len, idx});
       }
     }
   }
@@ -887,6 +935,8 @@ bool Interpreter::parse() {
     }
   } else if (peek("execfile")) {
     parseExec();
+  } else if (peek("vacuum")) {
+    parseVacuum();
   } else if (peek("quit")) {
     skip("quit");
     parseStatEnd();
@@ -38,6 +38,7 @@ class Interpreter {
       "select", "insert",  "create", "drop",     "delete", "table", "index",
       "from",   "where",   "quit",   "execfile", "unique", "into",  "values",
       "on",     "primary", "key",    "and",      "char",   "int",   "float",
+      "using",  "row",     "pax",    "vacuum",
   };
 
   enum class TokenKind {
@@ -108,6 +109,7 @@ class Interpreter {
   void parseDropTable();
   void parseDropIndex();
   void parseExec();
+  void parseVacuum();
   void parseStatEnd();
   void parseWhereClause();
   void parseBooleanClause();
@@ -1,8 +1,13 @@
 #include "RecordManager.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <ostream>
+#include <shared_mutex>
+#include <sstream>
 #include <stdexcept>
 #include <utility>
 
@@ -16,33 +21,296 @@ using std::endl;
 using std::ifstream;
 using std::ostream;
 
+// the header of a record block: the number of slots, the beginning of the
+// records (0 for the end of the block), the bytes in the records and the
+// number of free slots, all of them are 0 in a new block
+static constexpr size_t kSlotNumOffset = 0;
+static constexpr size_t kDataBeginOffset = 2;
+static constexpr size_t kLiveBytesOffset = 4;
+static constexpr size_t kFreeSlotsOffset = 6;
+static_assert(Config::kBlockSize <= UINT16_MAX,
+              "the offsets in a record block are 16-bit");
+
+static uint16_t load16(const char *p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static void store16(char *p, size_t v) {
+  const auto u = static_cast<uint16_t>(v);
+  memcpy(p, &u, sizeof(u));
+}
+
+static size_t bitmapSize(size_t slot_num) { return (slot_num + 63) / 64 * 8; }
+
+static size_t dataBegin(const char *val) {
+  const size_t begin = load16(val + kDataBeginOffset);
+  return begin ? begin : Config::kBlockSize;
+}
+
+/**
+ * @brief get the size of a record with its chars stripped of the trailing '\0's
+ */
+static size_t recordSize(const Tuple &tuple) {
+  size_t size = tuple.values.size() * RecordAccessProxy::kFieldSize;
+  for (auto &v : tuple.values) {
+    if (v.type < static_cast<SqlValueType>(SqlValueTypeBase::String)) continue;
+    size_t len = v.type - static_cast<SqlValueType>(SqlValueTypeBase::String);
+    size += strnlen(v.val.String, len);
+  }
+  return size;
+}
+
+static void encodeRecord(const Tuple &tuple, char *data) {
+  char *field = data;
+  size_t end = tuple.values.size() * RecordAccessProxy::kFieldSize;
+  for (auto &v : tuple.values) {
+    switch (v.type) {
+      case static_cast<SqlValueType>(SqlValueTypeBase::Integer):
+        memcpy(field, &v.val.Integer, sizeof(v.val.Integer));
+        break;
+      case static_cast<SqlValueType>(SqlValueTypeBase::Float):
+        memcpy(field, &v.val.Float, sizeof(v.val.Float));
+        break;
+      default: {
+        size_t len = strnlen(
+            v.val.String,
+            v.type - static_cast<SqlValueType>(SqlValueTypeBase::String));
+        store16(field, end);
+        store16(field + sizeof(uint16_t), len);
+        memcpy(data + end, v.val.String, len);
+        end += len;
+        break;
+      }
+    }
+    field += RecordAccessProxy::kFieldSize;
+  }
+}
+
+PaxLayout::PaxLayout(const Table &table) {
+  offsets.resize(table.attributes.size());
+  widths.resize(table.attributes.size());
+  size_t record_len = 0;
+  for (auto &[_1, attr] : table.attributes) {
+    auto &[idx, type, _2, _3] = attr;
+    if (type >= static_cast<SqlValueType>(SqlValueTypeBase::String))
+      widths[idx] = type - static_cast<SqlValueType>(SqlValueTypeBase::String);
+    else
+      widths[idx] = RecordAccessProxy::kFieldSize;
+    record_len += widths[idx];
+  }
+  // each minipage is padded to 16 bytes at most
+  slot_num = Config::kBlockSize * 8 / (record_len * 8 + 1);
+  while (true) {
+    size_t end = bitmapSize(slot_num);
+    for (size_t i = 0; i < widths.size(); i++) {
+      end = (end + 15) / 16 * 16;
+      offsets[i] = end;
+      end += widths[i] * slot_num;
+    }
+    if (end <= Config::kBlockSize) break;
+    slot_num--;
+  }
+}
+
+const Tuple &PaxLayout::extractData(const char *val, size_t slot,
+                                    Tuple &tuple) const {
+  for (size_t i = 0; i < tuple.values.size(); i++)
+    memcpy(&tuple.values[i].val, field(val, slot, i), widths[i]);
+  return tuple;
+}
+
+/**
+ * @brief get whether a comparison is true from the sign of its difference
+ */
+static bool compareResult(Operator op, int diff) {
+  switch (op) {
+    case Operator::GT:
+      return diff > 0;
+    case Operator::GE:
+      return diff >= 0;
+    case Operator::LT:
+      return diff < 0;
+    case Operator::LE:
+      return diff <= 0;
+    case Operator::EQ:
+      return diff == 0;
+    case Operator::NE:
+      return diff != 0;
+    default:
+      assert(0);
+  }
+  return false;
+}
+
+/**
+ * @brief clear the matches of the values in a minipage which don't satisfy a
+ * comparison, a loop without branches which the compiler vectorizes
+ */
+template <typename T, typename Compare>
+static void matchColumn(const char *column, size_t n, T v, Compare compare,
+                        uint8_t *match) {
+  for (size_t i = 0; i < n; i++) {
+    T x;
+    memcpy(&x, column + i * sizeof(T), sizeof(T));
+    match[i] &= compare(x, v);
+  }
+}
+
+template <typename T>
+static void matchColumn(const char *column, size_t n, Operator op, T v,
+                        uint8_t *match) {
+  switch (op) {
+    case Operator::GT:
+      return matchColumn(column, n, v, std::greater<T>(), match);
+    case Operator::GE:
+      return matchColumn(column, n, v, std::greater_equal<T>(), match);
+    case Operator::LT:
+      return matchColumn(column, n, v, std::less<T>(), match);
+    case Operator::LE:
+      return matchColumn(column, n, v, std::less_equal<T>(), match);
+    case Operator::EQ:
+      return matchColumn(column, n, v, std::equal_to<T>(), match);
+    case Operator::NE:
+      return matchColumn(column, n, v, std::not_equal_to<T>(), match);
+    default:
+      assert(0);
+  }
+}
+
+static void matchStrings(const char *column, size_t n, size_t width,
+                         Operator op, const char *v, uint8_t *match) {
+  for (size_t i = 0; i < n; i++)
+    if (match[i])
+      match[i] = compareResult(op, strncmp(column + i * width, v, width));
+}
+
 RecordAccessProxy::RecordAccessProxy(vector<size_t> *block_id,
                                      const Table *table, size_t blk_idx)
     : p_block_id_(block_id),
       p_table_(table),
-      record_len_(table->getAttributeSize() + 1 /* tag size is 1*/),
+      record_len_(maxRecordSize(*table)),
       blk_idx_(blk_idx) {
-  if (block_id->empty()) {
-    cur_blk_ = nullptr;
-    data_ = nullptr;
-    return;
-  }
-  cur_blk_ = static_cast<RecordBlock *>(
-      buffer_manager.Read(block_id->data()[blk_idx]));
-  cur_blk_->pin_ = true;
-  data_ = cur_blk_->val_;
   tuple_ = table->makeEmptyTuple();
+  if (table->layout == TableLayout::Pax) pax_ = PaxLayout(*table);
+  if (block_id->empty()) return;
+  cur_blk_ = static_cast<RecordBlock *>(
+      buffer_manager.Read(block_id->data()[blk_idx], AccessClass::Scan));
+  readAhead();
+}
+
+RecordAccessProxy::RecordAccessProxy(const RecordAccessProxy &other)
+    : p_block_id_(other.p_block_id_),
+      p_table_(other.p_table_),
+      record_len_(other.record_len_),
+      blk_idx_(other.blk_idx_),
+      slot_(other.slot_),
+      cur_blk_(other.cur_blk_),
+      read_ahead_idx_(other.read_ahead_idx_),
+      tuple_(other.tuple_),
+      pax_(other.pax_) {
+  if (cur_blk_) cur_blk_->Pin();
+}
+
+RecordAccessProxy::RecordAccessProxy(RecordAccessProxy &&other) noexcept
+    : p_block_id_(other.p_block_id_),
+      p_table_(other.p_table_),
+      record_len_(other.record_len_),
+      blk_idx_(other.blk_idx_),
+      slot_(other.slot_),
+      cur_blk_(std::exchange(other.cur_blk_, nullptr)),
+      read_ahead_idx_(other.read_ahead_idx_),
+      tuple_(std::move(other.tuple_)),
+      pax_(std::move(other.pax_)),
+      match_(std::move(other.match_)),
+      match_blk_(other.match_blk_),
+      match_conds_(other.match_conds_) {}
+
+RecordAccessProxy &RecordAccessProxy::operator=(
+    RecordAccessProxy other) noexcept {
+  std::swap(p_block_id_, other.p_block_id_);
+  std::swap(p_table_, other.p_table_);
+  std::swap(record_len_, other.record_len_);
+  std::swap(blk_idx_, other.blk_idx_);
+  std::swap(slot_, other.slot_);
+  std::swap(cur_blk_, other.cur_blk_);
+  std::swap(read_ahead_idx_, other.read_ahead_idx_);
+  std::swap(tuple_, other.tuple_);
+  std::swap(pax_, other.pax_);
+  std::swap(match_, other.match_);
+  std::swap(match_blk_, other.match_blk_);
+  std::swap(match_conds_, other.match_conds_);
+  return *this;
+}
+
+size_t RecordAccessProxy::maxRecordSize(const Table &table) {
+  size_t size = 0;
+  for (auto &[_1, attr] : table.attributes) {
+    auto &[_2, type, _3, _4] = attr;
+    size += kFieldSize;
+    if (type >= static_cast<SqlValueType>(SqlValueTypeBase::String))
+      size += type - static_cast<SqlValueType>(SqlValueTypeBase::String);
+  }
+  return size;
+}
+
+char *RecordAccessProxy::slotRecord(char *val, size_t slot_offset) {
+  const size_t offset = load16(val + slot_offset);
+  return offset ? val + offset : nullptr;
 }
 
 bool RecordAccessProxy::isCurrentSlotValid() {
-  if (data_)
-    return *data_;
-  else
-    return false;
+  if (!cur_blk_) return false;
+  if (isPax())
+    return slot_ < pax_.slot_num && pax_.isValid(cur_blk_->val_, slot_);
+  if (slot_ >= load16(cur_blk_->val_ + kSlotNumOffset)) return false;
+  return load16(cur_blk_->val_ + slotOffset(slot_)) != 0;
+}
+
+bool RecordAccessProxy::isCurrentSlotMatched(
+    const vector<tuple<Operator, SqlValue, size_t>> &conds) {
+  if (match_blk_ != blk_idx_ || match_conds_ != &conds) {
+    std::shared_lock latch(cur_blk_->latch_);
+    const char *val = cur_blk_->val_;
+    const size_t n = pax_.slot_num;
+    match_.resize(n);
+    for (size_t i = 0; i < n; i++) match_[i] = pax_.isValid(val, i);
+    for (auto &[op, v, idx] : conds) {
+      const char *column = val + pax_.offsets[idx];
+      switch (v.type) {
+        case static_cast<SqlValueType>(SqlValueTypeBase::Integer):
+          matchColumn(column, n, op, v.val.Integer, match_.data());
+          break;
+        case static_cast<SqlValueType>(SqlValueTypeBase::Float):
+          matchColumn(column, n, op, v.val.Float, match_.data());
+          break;
+        default:
+          matchStrings(column, n, pax_.widths[idx], op, v.val.String,
+                       match_.data());
+          break;
+      }
+    }
+    match_blk_ = blk_idx_;
+    match_conds_ = &conds;
+  }
+  return match_[slot_];
 }
 
 void RecordAccessProxy::releaseCurrentBlock() {
-  if (cur_blk_) cur_blk_->pin_ = false;
+  if (cur_blk_) cur_blk_->Unpin();
+  cur_blk_ = nullptr;
+}
+
+void RecordAccessProxy::readAhead() {
+  const auto window = buffer_manager.ReadAhead();
+  if (window == 0 || read_ahead_idx_ > blk_idx_ + 1 + window / 2) return;
+  const auto begin = std::max(read_ahead_idx_, blk_idx_ + 1);
+  const auto end = std::min(p_block_id_->size(), blk_idx_ + 1 + window);
+  if (begin >= end) return;
+  buffer_manager.Prefetch(vector<size_t>(p_block_id_->begin() + begin,
+                                         p_block_id_->begin() + end));
+  read_ahead_idx_ = end;
 }
 
 bool RecordAccessProxy::nextBlock() {
@@ -51,123 +319,230 @@ bool RecordAccessProxy::nextBlock() {
   } else {
     return false;
   }
-  cur_blk_->pin_ = false;
-  cur_blk_ = static_cast<RecordBlock *>(
-      buffer_manager.Read(p_block_id_->data()[blk_idx_]));
-  cur_blk_->pin_ = true;
-  data_ = cur_blk_->val_;
+  releaseCurrentBlock();  // not pinned twice if the next one can't be read
+  cur_blk_ = static_cast<RecordBlock *>(buffer_manager.Read(
+      p_block_id_->data()[blk_idx_], AccessClass::Scan));
+  slot_ = 0;
+  readAhead();
 
   return true;
 }
 
 void RecordAccessProxy::newBlock() {
-  size_t new_id = buffer_manager.NextId();
-  if (cur_blk_) {
-    cur_blk_->pin_ = false;
-    ++blk_idx_;
-  }
-  cur_blk_ = static_cast<RecordBlock *>(buffer_manager.Read(new_id));
-  cur_blk_->pin_ = true;
-  cur_blk_->dirty_ = true;
-  data_ = cur_blk_->val_;
-  memset(data_, 0, Config::kBlockSize);
+  size_t new_id;
+  auto new_blk = static_cast<RecordBlock *>(
+      buffer_manager.Create(new_id, PageType::Record));
+  releaseCurrentBlock();
+  cur_blk_ = new_blk;
+  slot_ = 0;
 
   p_block_id_->push_back(new_id);
+  blk_idx_ = p_block_id_->size() - 1;
+}
+
+void RecordAccessProxy::seekBlock(size_t blk_idx) {
+  releaseCurrentBlock();
+  blk_idx_ = blk_idx;
+  cur_blk_ = static_cast<RecordBlock *>(buffer_manager.Read(
+      p_block_id_->data()[blk_idx_], AccessClass::Point));
+  slot_ = 0;
+}
+
+bool RecordAccessProxy::isCurrentBlockFull() {
+  if (!cur_blk_) return true;
+  std::shared_lock latch(cur_blk_->latch_);
+  const char *val = cur_blk_->val_;
+  if (isPax()) {
+    for (size_t word = 0; word * 64 < pax_.slot_num; word++) {
+      uint64_t bits;
+      memcpy(&bits, val + word * sizeof(bits), sizeof(bits));
+      // the bits past the last slot are never set
+      const auto slots = std::min<size_t>(64, pax_.slot_num - word * 64);
+      if (static_cast<size_t>(std::popcount(bits)) != slots) return false;
+    }
+    return true;
+  }
+  const size_t used = slotOffset(load16(val + kSlotNumOffset)) +
+                      load16(val + kLiveBytesOffset);
+  const size_t slot = load16(val + kFreeSlotsOffset) ? 0 : kSlotSize;
+  return used + slot + record_len_ > Config::kBlockSize;
 }
 
 bool RecordAccessProxy::next() {
   if (!cur_blk_) return false;
-  data_ += record_len_;
-  if (data_ - cur_blk_->val_ + record_len_ < Config::kBlockSize) return true;
+  if (!isPax()) {
+    if (++slot_ < load16(cur_blk_->val_ + kSlotNumOffset)) return true;
+    return nextBlock();
+  }
+  size_t slot = slot_ + 1;
+  if (match_blk_ == blk_idx_) {
+    // skip the slots which don't satisfy the conditions of the scan
+    while (slot < pax_.slot_num && !match_[slot]) slot++;
+  } else {
+    // skip the free slots by the bitmap
+    while (slot < pax_.slot_num) {
+      uint64_t bits;
+      memcpy(&bits, cur_blk_->val_ + slot / 64 * sizeof(bits), sizeof(bits));
+      bits >>= slot % 64;
+      if (bits) {
+        slot += std::countr_zero(bits);
+        break;
+      }
+      slot = slot / 64 * 64 + 64;
+    }
+  }
+  if (slot < pax_.slot_num) {
+    slot_ = slot;
+    return true;
+  }
+  slot_ = pax_.slot_num;
   return nextBlock();
 }
 
 const Tuple &RecordAccessProxy::extractData() {
   assert(isCurrentSlotValid());
-  char *tmp = data_ + 1;
-  for (auto &v : tuple_.values) {
-    switch (v.type) {
-      case static_cast<SqlValueType>(SqlValueTypeBase::Integer):
-        memcpy(&v.val.Integer, tmp, sizeof(v.val.Integer));
-        tmp += sizeof(v.val.Integer);
-        break;
-      case static_cast<SqlValueType>(SqlValueTypeBase::Float):
-        memcpy(&v.val.Float, tmp, sizeof(v.val.Float));
-        tmp += sizeof(v.val.Float);
-        break;
-      default: {
-        size_t len =
-            v.type - static_cast<SqlValueType>(SqlValueTypeBase::String);
-        memcpy(v.val.String, tmp, len);
-        tmp += len;
-        break;
-      }
-    }
-  }
-  return tuple_;
+  std::shared_lock latch(cur_blk_->latch_);
+  if (isPax()) return pax_.extractData(cur_blk_->val_, slot_, tuple_);
+  return extractData(getRawData(), tuple_);
 }
 
 const Tuple &RecordAccessProxy::extractData(const char *data, Tuple &tuple) {
-  const char *tmp = data + 1;
+  const char *field = data;
   for (auto &v : tuple.values) {
     switch (v.type) {
       case static_cast<SqlValueType>(SqlValueTypeBase::Integer):
-        memcpy(&v.val.Integer, tmp, sizeof(v.val.Integer));
-        tmp += sizeof(v.val.Integer);
+        memcpy(&v.val.Integer, field, sizeof(v.val.Integer));
         break;
       case static_cast<SqlValueType>(SqlValueTypeBase::Float):
-        memcpy(&v.val.Float, tmp, sizeof(v.val.Float));
-        tmp += sizeof(v.val.Float);
+        memcpy(&v.val.Float, field, sizeof(v.val.Float));
         break;
       default: {
         size_t len =
             v.type - static_cast<SqlValueType>(SqlValueTypeBase::String);
-        memcpy(v.val.String, tmp, len);
-        tmp += len;
+        const size_t size = load16(field + sizeof(uint16_t));
+        memcpy(v.val.String, data + load16(field), size);
+        memset(v.val.String + size, 0, len - size);
         break;
       }
     }
+    field += kFieldSize;
   }
   return tuple;
 }
 
-char *RecordAccessProxy::getRawData() { return data_ + 1; }
+char *RecordAccessProxy::getRawData() {
+  return slotRecord(cur_blk_->val_, slotOffset(slot_));
+}
 
 Position RecordAccessProxy::extractPostion() {
   Position pos;
   pos.block_id = p_block_id_->data()[blk_idx_];
-  pos.offset = data_ - cur_blk_->val_ + 1 /* skip the 1-byte tag */;
+  pos.offset = slotOffset(slot_);
   return pos;
 }
 
 void RecordAccessProxy::deleteRecord() {
-  cur_blk_->dirty_ = true;
-  *data_ = 0;
+  std::lock_guard latch(cur_blk_->latch_);
+  cur_blk_->MarkDirty();
+  char *val = cur_blk_->val_;
+  if (isPax()) {
+    val[slot_ / 8] &= ~(1 << slot_ % 8);
+    BufferManager::LogUpdate(p_block_id_->data()[blk_idx_], cur_blk_,
+                             slot_ / 8, 1);
+    return;
+  }
+  char *slot = val + slotOffset(slot_);
+  store16(val + kLiveBytesOffset,
+          load16(val + kLiveBytesOffset) - load16(slot + sizeof(uint16_t)));
+  store16(val + kFreeSlotsOffset, load16(val + kFreeSlotsOffset) + 1);
+  store16(slot, 0);
+  store16(slot + sizeof(uint16_t), 0);
+  const auto id = p_block_id_->data()[blk_idx_];
+  BufferManager::LogUpdate(id, cur_blk_, 0, kHeaderSize);
+  BufferManager::LogUpdate(id, cur_blk_, slot - val, kSlotSize);
 }
 
-void RecordAccessProxy::modifyData(const Tuple &tuple) {
-  cur_blk_->dirty_ = true;
-  *data_ = 1;
-  char *tmp = data_ + 1;
-  for (auto &v : tuple.values) {
-    switch (v.type) {
-      case static_cast<SqlValueType>(SqlValueTypeBase::Integer):
-        memcpy(tmp, &v.val.Integer, sizeof(v.val.Integer));
-        tmp += sizeof(v.val.Integer);
-        break;
-      case static_cast<SqlValueType>(SqlValueTypeBase::Float):
-        memcpy(tmp, &v.val.Float, sizeof(v.val.Float));
-        tmp += sizeof(v.val.Float);
-        break;
-      default: {
-        size_t len =
-            v.type - static_cast<SqlValueType>(SqlValueTypeBase::String);
-        memcpy(tmp, v.val.String, len);
-        tmp += len;
-        break;
-      }
+bool RecordAccessProxy::insertPax(const Tuple &tuple) {
+  std::lock_guard latch(cur_blk_->latch_);
+  char *val = cur_blk_->val_;
+  size_t slot = pax_.slot_num;
+  for (size_t word = 0; word * 64 < pax_.slot_num; word++) {
+    uint64_t bits;
+    memcpy(&bits, val + word * sizeof(bits), sizeof(bits));
+    if (~bits == 0) continue;
+    slot = word * 64 + std::countr_one(bits);
+    break;
+  }
+  if (slot >= pax_.slot_num) return false;
+  cur_blk_->MarkDirty();
+  slot_ = slot;
+  val[slot_ / 8] |= 1 << slot_ % 8;
+  const auto id = p_block_id_->data()[blk_idx_];
+  BufferManager::LogUpdate(id, cur_blk_, slot_ / 8, 1);
+  for (size_t i = 0; i < tuple.values.size(); i++) {
+    char *field = pax_.field(val, slot_, i);
+    memcpy(field, &tuple.values[i].val, pax_.widths[i]);
+    BufferManager::LogUpdate(id, cur_blk_, field - val, pax_.widths[i]);
+  }
+  return true;
+}
+
+bool RecordAccessProxy::insertData(const Tuple &tuple) {
+  if (isPax()) return insertPax(tuple);
+  const size_t size = recordSize(tuple);
+  std::lock_guard latch(cur_blk_->latch_);
+  char *val = cur_blk_->val_;
+  size_t slot_num = load16(val + kSlotNumOffset);
+  size_t free_slots = load16(val + kFreeSlotsOffset);
+  const size_t live_bytes = load16(val + kLiveBytesOffset);
+  const size_t dir_end = slotOffset(slot_num + (free_slots ? 0 : 1));
+  if (dir_end + live_bytes + size > Config::kBlockSize) return false;
+  cur_blk_->MarkDirty();
+
+  // the free space between the slots and the records is too small, move the
+  // records to the end of the block to gather the space of the deleted ones
+  size_t begin = dataBegin(val);
+  const bool compacted = dir_end + size > begin;
+  if (compacted) {
+    char records[Config::kBlockSize];
+    memcpy(records, val, Config::kBlockSize);
+    begin = Config::kBlockSize;
+    for (size_t i = 0; i < slot_num; i++) {
+      char *slot = val + slotOffset(i);
+      const size_t offset = load16(slot);
+      if (offset == 0) continue;
+      const size_t record_size = load16(slot + sizeof(uint16_t));
+      begin -= record_size;
+      memcpy(val + begin, records + offset, record_size);
+      store16(slot, begin);
     }
   }
+
+  if (free_slots) {
+    slot_ = 0;
+    while (load16(val + slotOffset(slot_)) != 0) slot_++;
+    free_slots--;
+  } else {
+    slot_ = slot_num++;
+  }
+  begin -= size;
+  encodeRecord(tuple, val + begin);
+  store16(val + slotOffset(slot_), begin);
+  store16(val + slotOffset(slot_) + sizeof(uint16_t), size);
+  store16(val + kSlotNumOffset, slot_num);
+  store16(val + kDataBeginOffset, begin);
+  store16(val + kLiveBytesOffset, live_bytes + size);
+  store16(val + kFreeSlotsOffset, free_slots);
+
+  const auto id = p_block_id_->data()[blk_idx_];
+  if (compacted) {
+    BufferManager::LogUpdate(id, cur_blk_, 0, Config::kBlockSize);
+  } else {
+    BufferManager::LogUpdate(id, cur_blk_, 0, kHeaderSize);
+    BufferManager::LogUpdate(id, cur_blk_, slotOffset(slot_), kSlotSize);
+    BufferManager::LogUpdate(id, cur_blk_, begin, size);
+  }
+  return true;
 }
 
 RecordManager::RecordManager() {
@@ -198,12 +573,25 @@ RecordManager::RecordManager() {
       blks.push_back(block_id);
     }
     table_blocks[table_name] = blks;
+
+    size_t free_count;
+    auto &free_blks = table_free[table_name];
+    is.read(reinterpret_cast<char *>(&free_count), sizeof(free_count));
+    for (size_t j = 0; j < free_count; ++j) {
+      size_t blk_idx;
+      is.read(reinterpret_cast<char *>(&blk_idx), sizeof(blk_idx));
+      free_blks.insert(free_blks.end(), blk_idx);
+    }
   }
 }
 
 RecordManager::~RecordManager() {
+  if (BufferManager::ReadOnly()) return;  // the files are left as they were
   ofstream os(Config::kRecordFileName, std::ios::binary);
+  save(os);
+}
 
+void RecordManager::save(std::ostream &os) const {
   size_t table_count = table_blocks.size();
   os.write(reinterpret_cast<char *>(&table_count), sizeof(table_count));
 
@@ -221,19 +609,50 @@ RecordManager::~RecordManager() {
     for (size_t j = 0; j < block_count; ++j) {
       os.write(reinterpret_cast<const char *>(&blks[j]), sizeof(blks[j]));
     }
+
+    const auto iter = table_free.find(table_name);
+    size_t free_count = iter == table_free.end() ? 0 : iter->second.size();
+    os.write(reinterpret_cast<char *>(&free_count), sizeof(free_count));
+    if (free_count == 0) continue;
+    for (const auto &blk_idx : iter->second)
+      os.write(reinterpret_cast<const char *>(&blk_idx), sizeof(blk_idx));
   }
 }
 
+void RecordManager::logSnapshot() const {
+  std::ostringstream os;
+  save(os);
+  BufferManager::LogMeta(MetaKind::Record, os.view());
+}
+
 bool RecordManager::checkAttributeUnique(const Table &table,
                                          vector<size_t> &blks, const char *v,
-                                         size_t len, size_t offset) {
+                                         size_t len, size_t idx) {
   RecordAccessProxy rap(&blks, &table, 0);
+  if (rap.isPax()) {
+    SqlValue val;
+    val.type = rap.tuple_.values[idx].type;
+    memcpy(&val.val, v, len);
+    const vector<tuple<Operator, SqlValue, size_t>> conds = {
+        {Operator::EQ, val, idx}};
+    do {
+      if (rap.isCurrentSlotValid() && rap.isCurrentSlotMatched(conds))
+        return false;
+    } while (rap.next());
+    return true;
+  }
+  const size_t offset = idx * RecordAccessProxy::kFieldSize;
   do {
     if (!rap.isCurrentSlotValid()) continue;
     auto data = rap.getRawData();
     if (len == 4) {
       if (memcmp32(data + offset, v, 1) == 0) return false;
-    } else if (memcmp128(data + offset, v, len / 16) == 0)
+      continue;
+    }
+    // v is padded with '\0's, the char in the record is not
+    const size_t size = load16(data + offset + sizeof(uint16_t));
+    if (memcmp(data + load16(data + offset), v, size) == 0 &&
+        (size == len || v[size] == '\0'))
       return false;
   } while (rap.next());
   return true;
@@ -248,6 +667,8 @@ bool RecordManager::createTable(const Table &table) {
   table_blocks.insert({table.table_name, {}});
   table_current.emplace(table.table_name, rap);
   table_current[table.table_name].newBlock();
+  table_free[table.table_name] = {0};
+  logSnapshot();
   return true;
 }
 
@@ -256,14 +677,13 @@ bool RecordManager::dropTable(const Table &table) {
     cerr << "such a table doesn't exist" << endl;
     return false;
   }
-  for (auto &id : table_blocks[table.table_name]) {
-    auto p = buffer_manager.Read(id);
-    memset(p->val_, 0, Config::kBlockSize);
-    p->dirty_ = true;
-    p->pin_ = false;
-  }
-  table_blocks.erase(table.table_name);
+  if (table_current.contains(table.table_name))
+    table_current[table.table_name].releaseCurrentBlock();
   table_current.erase(table.table_name);
+  for (auto &id : table_blocks[table.table_name]) buffer_manager.Free(id);
+  table_blocks.erase(table.table_name);
+  table_free.erase(table.table_name);
+  logSnapshot();
   return true;
 }
 
@@ -288,26 +708,40 @@ vector<tuple<Operator, SqlValue, size_t>> RecordManager::convertConditions(
     const Table &table, const vector<Condition> conds) {
   vector<tuple<Operator, SqlValue, size_t>> res;
   for (auto &cond : conds) {
-    auto &[_1, _2, _3, offset] = table.attributes.find(cond.attribute)->second;
-    res.push_back({cond.op, cond.val, offset});
+    auto &[idx, _1, _2, _3] = table.attributes.find(cond.attribute)->second;
+    res.push_back({cond.op, cond.val, idx});
   }
   return res;
 }
 
 bool RecordManager::checkRecordSatisfyCondition(
-    const vector<tuple<Operator, SqlValue, size_t>> &conds, char *record) {
-  for (auto &[op, val, offset] : conds) {
-    if (!rawCompare(op, val, offset, record)) return false;
+    const vector<tuple<Operator, SqlValue, size_t>> &conds,
+    const char *record) {
+  for (auto &[op, val, idx] : conds) {
+    const char *field = record + idx * RecordAccessProxy::kFieldSize;
+    if (val.type < static_cast<SqlValueType>(SqlValueTypeBase::String)) {
+      if (!rawCompare(op, val, field, sizeof(int))) return false;
+    } else if (!rawCompare(op, val, record + load16(field),
+                           load16(field + sizeof(uint16_t)))) {
+      return false;
+    }
   }
   return true;
 }
 
-bool RecordManager::rawCompare(Operator op, SqlValue val, size_t offset,
-                               char *record) {
+bool RecordManager::checkRecordSatisfyCondition(
+    const vector<tuple<Operator, SqlValue, size_t>> &conds,
+    RecordAccessProxy &rap) {
+  if (rap.isPax()) return rap.isCurrentSlotMatched(conds);
+  return checkRecordSatisfyCondition(conds, rap.getRawData());
+}
+
+bool RecordManager::rawCompare(Operator op, const SqlValue &val,
+                               const char *data, size_t size) {
   switch (val.type) {
     case static_cast<SqlValueType>(SqlValueTypeBase::Integer): {
       int record_num;
-      memcpy(&record_num, record + offset, sizeof(record_num));
+      memcpy(&record_num, data, sizeof(record_num));
       switch (op) {
         case Operator::GT:
           return record_num > val.val.Integer;
@@ -334,7 +768,7 @@ bool RecordManager::rawCompare(Operator op, SqlValue val, size_t offset,
     }
     case static_cast<SqlValueType>(SqlValueTypeBase::Float): {
       float record_num;
-      memcpy(&record_num, record + offset, sizeof(record_num));
+      memcpy(&record_num, data, sizeof(record_num));
       switch (op) {
         case Operator::GT:
           return record_num > val.val.Float;
@@ -363,7 +797,7 @@ bool RecordManager::rawCompare(Operator op, SqlValue val, size_t offset,
       size_t len =
           val.type - static_cast<SqlValueType>(SqlValueTypeBase::String);
       char buf[Config::kMaxStringLength] = {0};
-      memcpy(buf, record + offset, len);
+      memcpy(buf, data, size);
       switch (op) {
         case Operator::GT:
           return strncmp(buf, val.val.String, len) > 0;
@@ -392,42 +826,45 @@ bool RecordManager::rawCompare(Operator op, SqlValue val, size_t offset,
   return false;
 }
 
-Position RecordManager::insertRecord(const Table &table, const Tuple &tuple) {
-  checkTableName(table);
+Position RecordManager::insertIntoFreeSlot(const Table &table,
+                                           const Tuple &tuple) {
   if (!table_current.contains(table.table_name))
     table_current[table.table_name] =
         RecordAccessProxy(&table_blocks[table.table_name], &table, 0);
   auto &access = table_current[table.table_name];
-  while (access.isCurrentSlotValid()) {
-    if (!access.next()) {
+  auto &free_blks = table_free[table.table_name];
+  while (true) {
+    if (free_blks.empty()) {
       access.newBlock();
+      free_blks.insert(access.blk_idx_);
+      logSnapshot();
+    } else if (!access.cur_blk_ || access.blk_idx_ != *free_blks.begin()) {
+      access.seekBlock(*free_blks.begin());
     }
+    if (access.insertData(tuple)) break;
+    free_blks.erase(access.blk_idx_);
   }
-  access.modifyData(tuple);
+  if (access.isCurrentBlockFull()) free_blks.erase(access.blk_idx_);
   return access.extractPostion();
 }
 
+Position RecordManager::insertRecord(const Table &table, const Tuple &tuple) {
+  checkTableName(table);
+  return insertIntoFreeSlot(table, tuple);
+}
+
 Position RecordManager::insertRecordUnique(
     const Table &table, const Tuple &tp,
     const vector<tuple<const char *, size_t, size_t>> &unique) {
-  if (!table_current.contains(table.table_name))
-    table_current[table.table_name] =
-        RecordAccessProxy(&table_blocks[table.table_name], &table, 0);
-  auto &access = table_current[table.table_name];
   for (auto &u : unique) {
-    auto &[p, len, offset] = u;
-    if (!checkAttributeUnique(table, *access.p_block_id_, p, len, offset)) {
+    auto &[p, len, idx] = u;
+    if (!checkAttributeUnique(table, table_blocks[table.table_name], p, len,
+                              idx)) {
       cerr << "the record is not unique" << endl;
       throw invalid_value("record duplicate");
     }
   }
-  while (access.isCurrentSlotValid()) {
-    if (!access.next()) {
-      access.newBlock();
-    }
-  }
-  access.modifyData(tp);
-  return access.extractPostion();
+  return insertIntoFreeSlot(table, tp);
 }
 
 vector<Tuple> RecordManager::selectRecord(const Table &table,
@@ -439,7 +876,7 @@ vector<Tuple> RecordManager::selectRecord(const Table &table,
   auto conds_ = convertConditions(table, conds);
   do {
     if (!rap.isCurrentSlotValid()) continue;
-    if (checkRecordSatisfyCondition(conds_, rap.getRawData()))
+    if (checkRecordSatisfyCondition(conds_, rap))
       res.push_back(rap.extractData());
   } while (rap.next());
   return res;
@@ -453,10 +890,29 @@ vector<Tuple> RecordManager::selectRecordFromPosition(
   checkTableName(table);
   checkConditionValid(table, conds);
   auto conds_ = convertConditions(table, conds);
+  const PaxLayout pax =
+      table.layout == TableLayout::Pax ? PaxLayout(table) : PaxLayout();
   for (auto &p : pos) {
-    auto data = buffer_manager.Read(p.block_id)->val_ + p.offset;
-    if (checkRecordSatisfyCondition(conds_, data))
-      res.push_back(RecordAccessProxy::extractData(data - 1, tmp));
+    auto blk = buffer_manager.Read(p.block_id, AccessClass::Point);
+    if (pax.slot_num) {
+      std::shared_lock latch(blk->latch_);
+      const size_t slot = RecordAccessProxy::slotOf(p.offset);
+      const bool matched =
+          pax.isValid(blk->val_, slot) &&
+          std::all_of(conds_.begin(), conds_.end(), [&](auto &cond) {
+            auto &[op, val, idx] = cond;
+            return rawCompare(op, val, pax.field(blk->val_, slot, idx),
+                              pax.widths[idx]);
+          });
+      if (matched) res.push_back(pax.extractData(blk->val_, slot, tmp));
+    } else {
+      std::shared_lock latch(blk->latch_);
+      // the record may have been deleted since the position was taken
+      auto data = RecordAccessProxy::slotRecord(blk->val_, p.offset);
+      if (data && checkRecordSatisfyCondition(conds_, data))
+        res.push_back(RecordAccessProxy::extractData(data, tmp));
+    }
+    blk->Unpin();
   }
   return res;
 }
@@ -472,35 +928,100 @@ vector<Tuple> RecordManager::selectAllRecords(const Table &table) {
   return res;
 }
 
-size_t RecordManager::deleteRecord(const Table &table,
-                                   const vector<Condition> &conds) {
+size_t RecordManager::deleteRecord(
+    const Table &table, const vector<Condition> &conds,
+    const std::function<void(const Tuple &, const Position &)> &on_delete) {
   size_t n = 0;
   checkTableName(table);
   checkConditionValid(table, conds);
   RecordAccessProxy rap(&table_blocks[table.table_name], &table, 0);
   auto conds_ = convertConditions(table, conds);
+  auto &free_blks = table_free[table.table_name];
+  bool freed = false;  // a full block has got free slots
   do {
     if (!rap.isCurrentSlotValid()) continue;
-    if (checkRecordSatisfyCondition(conds_, rap.getRawData())) {
+    if (checkRecordSatisfyCondition(conds_, rap)) {
+      if (on_delete) on_delete(rap.extractData(), rap.extractPostion());
       rap.deleteRecord();
+      freed |= free_blks.insert(rap.blk_idx_).second;
       n++;
     }
   } while (rap.next());
+  if (freed) logSnapshot();
   return n;
 }
 
-size_t RecordManager::deleteAllRecords(const Table &table) {
+size_t RecordManager::deleteAllRecords(
+    const Table &table,
+    const std::function<void(const Tuple &, const Position &)> &on_delete) {
   size_t n = 0;
   checkTableName(table);
   RecordAccessProxy rap(&table_blocks[table.table_name], &table, 0);
+  auto &free_blks = table_free[table.table_name];
+  bool freed = false;
   do {
     if (!rap.isCurrentSlotValid()) continue;
+    if (on_delete) on_delete(rap.extractData(), rap.extractPostion());
     rap.deleteRecord();
+    freed |= free_blks.insert(rap.blk_idx_).second;
     n++;
   } while (rap.next());
+  if (freed) logSnapshot();
   return n;
 }
 
+VacuumStats RecordManager::vacuumTable(
+    const Table &table,
+    const std::function<void(const Tuple &, const Position &,
+                             const Position &)> &on_move) {
+  checkTableName(table);
+  auto &blks = table_blocks[table.table_name];
+  auto &free_blks = table_free[table.table_name];
+  // the blocks after dst may be freed
+  if (table_current.contains(table.table_name))
+    table_current[table.table_name].releaseCurrentBlock();
+  VacuumStats stats{};
+  vector<size_t> emptied;
+  RecordAccessProxy dst(&blks, &table, 0);
+  bool full = false;  // a record of the last block doesn't fit before it
+  while (!full && dst.blk_idx_ + 1 < blks.size()) {
+    RecordAccessProxy src(&blks, &table, blks.size() - 1);
+    bool moved = false;  // the block has got free slots
+    do {
+      if (!src.isCurrentSlotValid()) continue;
+      const Tuple &tuple = src.extractData();
+      while (!dst.insertData(tuple)) {
+        if (dst.blk_idx_ + 2 == blks.size()) {
+          full = true;
+          break;
+        }
+        dst.seekBlock(dst.blk_idx_ + 1);
+      }
+      if (full) break;
+      src.deleteRecord();
+      if (on_move) on_move(tuple, src.extractPostion(), dst.extractPostion());
+      stats.moved++;
+      moved = true;
+    } while (src.next());
+    if (full) {
+      if (moved) free_blks.insert(src.blk_idx_);
+      break;
+    }
+    emptied.push_back(blks.back());
+    blks.pop_back();
+  }
+  // the blocks before dst have refused a record
+  free_blks.erase(free_blks.begin(), free_blks.lower_bound(dst.blk_idx_));
+  free_blks.erase(free_blks.lower_bound(blks.size()), free_blks.end());
+  if (!dst.isCurrentBlockFull()) free_blks.insert(dst.blk_idx_);
+  if (stats.moved || !emptied.empty()) logSnapshot();
+  // freed after the snapshot without them, a crash in between leaks them
+  // instead of leaving the table with freed blocks
+  for (auto &id : emptied) buffer_manager.Free(id);
+  stats.released = emptied.size();
+  return stats;
+}
+
 RecordAccessProxy RecordManager::getIterator(const Table &table) {
   RecordAccessProxy rap(&table_blocks[table.table_name], &table, 0);
   return rap;
@@ -8,6 +8,7 @@
 #include <functional>
 #include <iostream>
 #include <map>
+#include <set>
 #include <ostream>
 #include <stdexcept>
 #include <string>
@@ -22,45 +23,199 @@
 
 using RecordBlock = Block;
 
+/**
+ * @brief the layout of a block of a PAX table: a bitmap of the occupied slots,
+ * followed by a minipage for each attribute with its values in all the slots,
+ * so that a condition on an attribute reads an array. A minipage is aligned to
+ * 16 bytes, and a char takes its whole size in it.
+ */
+struct PaxLayout {
+  size_t slot_num = 0;
+  vector<size_t> offsets;  // the offset of the minipage of each attribute
+  vector<size_t> widths;   // the size of a value of each attribute
+
+  PaxLayout() = default;
+  explicit PaxLayout(const Table& table);
+  bool isValid(const char* val, size_t slot) const {
+    return val[slot / 8] >> slot % 8 & 1;
+  }
+  const char* field(const char* val, size_t slot, size_t idx) const {
+    return val + offsets[idx] + slot * widths[idx];
+  }
+  char* field(char* val, size_t slot, size_t idx) const {
+    return val + offsets[idx] + slot * widths[idx];
+  }
+  const Tuple& extractData(const char* val, size_t slot, Tuple& tuple) const;
+};
+
+/**
+ * @brief a record block is a slotted page: a header, a directory of the slots,
+ * each with the offset and the size of its record (offset 0 for a free slot),
+ * and the records packed at the end of the block. A record is found through
+ * its slot, so it keeps its Position (the offset of the slot) when the block
+ * is compacted.
+ *
+ * A record has a 4-byte field for each attribute, in the order of the
+ * attributes: the value of an int or a float, or the offset and the size of a
+ * char, whose bytes come after the fields without the trailing '\0's.
+ *
+ * The blocks of a PAX table are laid out by PaxLayout instead, the Position of
+ * a record is the offset its slot would have in a slotted page.
+ */
 struct RecordAccessProxy {
-  vector<size_t>* p_block_id_;
-  const Table* p_table_;
-  size_t record_len_;
-  size_t blk_idx_;
-  RecordBlock* cur_blk_;
-  char* data_;
+  static constexpr size_t kHeaderSize = 4 * sizeof(uint16_t);
+  static constexpr size_t kSlotSize = 2 * sizeof(uint16_t);
+  static constexpr size_t kFieldSize = 4;
+
+  vector<size_t>* p_block_id_ = nullptr;
+  const Table* p_table_ = nullptr;
+  size_t record_len_ = 0;  // the size of the largest record of the table
+  size_t blk_idx_ = 0;
+  size_t slot_ = 0;                 // the slot of the record in the block
+  RecordBlock* cur_blk_ = nullptr;  // pinned as long as the proxy points to it
+  size_t read_ahead_idx_ = 0;  // the blocks before it have been prefetched
   Tuple tuple_;
+  PaxLayout pax_;  // no slots for a row table
+  // whether each slot of the block blk_idx_ of a PAX table is occupied by a
+  // record which satisfies the conditions match_conds_, next skips the other
+  // slots of the block once it is computed
+  vector<uint8_t> match_;
+  size_t match_blk_ = SIZE_MAX;
+  const void* match_conds_ = nullptr;
 
   RecordAccessProxy() = default;
   RecordAccessProxy(vector<size_t>* block_id, const Table* table,
                     size_t blk_idx);
+  RecordAccessProxy(const RecordAccessProxy& other);
+  RecordAccessProxy(RecordAccessProxy&& other) noexcept;
+  RecordAccessProxy& operator=(RecordAccessProxy other) noexcept;
+  ~RecordAccessProxy() { releaseCurrentBlock(); }
+  /**
+   * @brief get the size of the largest record of a table, its chars are full
+   *
+   * @param table the table
+   */
+  static size_t maxRecordSize(const Table& table);
+  /**
+   * @brief get the record in a slot of a block
+   *
+   * @param val the block
+   * @param slot_offset the offset of the slot in the block
+   * @return nullptr if the slot is free
+   */
+  static char* slotRecord(char* val, size_t slot_offset);
+  static size_t slotOffset(size_t slot) {
+    return kHeaderSize + slot * kSlotSize;
+  }
+  static size_t slotOf(size_t slot_offset) {
+    return (slot_offset - kHeaderSize) / kSlotSize;
+  }
+  bool isPax() const { return pax_.slot_num != 0; }
   bool isCurrentSlotValid();
+  /**
+   * @brief whether the record in the current slot of a PAX table satisfies
+   * some conditions, they are checked for all the slots of a block at once,
+   * one attribute after another
+   *
+   * @param conds the operator, the value and the index of the attribute of
+   * each condition
+   */
+  bool isCurrentSlotMatched(
+      const vector<tuple<Operator, SqlValue, size_t>>& conds);
+  /**
+   * @brief unpin the current block, the proxy points to nothing afterwards
+   */
   void releaseCurrentBlock();
+  /**
+   * @brief prefetch the blocks after the current one when the scan gets close
+   * to the end of the blocks already prefetched
+   */
+  void readAhead();
   bool nextBlock();
   void newBlock();
+  /**
+   * @brief move to the first slot of a block
+   *
+   * @param blk_idx the index of the block in the blocks of the table
+   */
+  void seekBlock(size_t blk_idx);
+  /**
+   * @brief whether the largest record of the table doesn't fit in the free
+   * space of the current block
+   */
+  bool isCurrentBlockFull();
   bool next();
   const Tuple& extractData();
   static const Tuple& extractData(const char* data, Tuple& tuple);
   char* getRawData();
   Position extractPostion();
   void deleteRecord();
-  void modifyData(const Tuple& tuple);
+  /**
+   * @brief put a record into a free slot of the current block, the block is
+   * compacted if its free space is fragmented, the proxy points to the record
+   * afterwards
+   *
+   * @param tuple the record
+   * @return false if the record doesn't fit in the block
+   */
+  bool insertData(const Tuple& tuple);
+  bool insertPax(const Tuple& tuple);
 };
 
 class RecordManager {
   unordered_map<std::string, vector<size_t>> table_blocks;
   unordered_map<std::string, RecordAccessProxy> table_current;
+  // the free-space map: the indexes in table_blocks of the blocks which may
+  // have room for a record, a block is dropped when an insert finds it full
+  unordered_map<std::string, std::set<size_t>> table_free;
 
  private:
+  /**
+   * @brief write the blocks of the tables as they are stored in the file
+   *
+   * @param os the stream
+   */
+  void save(std::ostream& os) const;
+  /**
+   * @brief log a snapshot of the blocks of the tables after they are changed
+   */
+  void logSnapshot() const;
   void checkConditionValid(const Table& table, const vector<Condition>& conds);
   void checkTableName(const Table& table);
   vector<tuple<Operator, SqlValue, size_t>> convertConditions(
       const Table& table, const vector<Condition> conds);
   bool checkRecordSatisfyCondition(
-      const vector<tuple<Operator, SqlValue, size_t>>& conds, char* record);
-  bool rawCompare(Operator op, SqlValue val, size_t offset, char* record);
+      const vector<tuple<Operator, SqlValue, size_t>>& conds,
+      const char* record);
+  bool checkRecordSatisfyCondition(
+      const vector<tuple<Operator, SqlValue, size_t>>& conds,
+      RecordAccessProxy& rap);
+  /**
+   * @brief compare a value in a record with the value of a condition
+   *
+   * @param data the value in the record
+   * @param size the size of the value of a char
+   */
+  bool rawCompare(Operator op, const SqlValue& val, const char* data,
+                  size_t size);
+  /**
+   * @brief whether no record of the table has a value in an attribute
+   *
+   * @param v the value, a char is padded with '\0's to its size
+   * @param len the size of the attribute
+   * @param idx the index of the attribute in the record
+   */
   bool checkAttributeUnique(const Table& table, vector<size_t>& blks,
-                            const char* v, size_t len, size_t offset);
+                            const char* v, size_t len, size_t idx);
+  /**
+   * @brief put a record into the first block of the table with room for it, a
+   * new block is created if none of the blocks has room
+   *
+   * @param table the table
+   * @param tuple the record
+   * @return the position of the record
+   */
+  Position insertIntoFreeSlot(const Table& table, const Tuple& tuple);
 
  public:
   RecordManager();
@@ -77,8 +232,37 @@ class RecordManager {
   vector<Tuple> selectRecordFromPosition(const Table& table,
                                          const vector<Position>& pos,
                                          const vector<Condition>& conds);
-  size_t deleteRecord(const Table& table, const vector<Condition>& conds);
-  size_t deleteAllRecords(const Table& table);
+  /**
+   * @brief delete the records which satisfy the conditions
+   *
+   * @param table the table
+   * @param conds the conditions
+   * @param on_delete called with each deleted record and its position, e.g.
+   * to remove its keys from the indexes
+   * @return the number of deleted records
+   */
+  size_t deleteRecord(
+      const Table& table, const vector<Condition>& conds,
+      const std::function<void(const Tuple&, const Position&)>& on_delete =
+          nullptr);
+  size_t deleteAllRecords(
+      const Table& table,
+      const std::function<void(const Tuple&, const Position&)>& on_delete =
+          nullptr);
+  /**
+   * @brief compact a table: the records of its last blocks are moved into the
+   * free slots of its first blocks, and the emptied blocks are freed, until
+   * the next record of the last block doesn't fit before it
+   *
+   * @param table the table
+   * @param on_move called with each moved record, its old position and its
+   * new one, e.g. to update the indexes
+   * @return the numbers of moved records and freed blocks
+   */
+  VacuumStats vacuumTable(
+      const Table& table,
+      const std::function<void(const Tuple&, const Position&,
+                               const Position&)>& on_move = nullptr);
   RecordAccessProxy getIterator(const Table& table);
 };
 
@@ -3,7 +3,11 @@
 #include <filesystem>
 #include <ios>
 #include <iostream>
+#include <string>
+#include <string_view>
 
+#include "BlockStore.hpp"
+#include "BufferManager.hpp"
 #include "DataStructure.hpp"
 #include "Interpreter.hpp"
 #include "IndexManager.hpp"
@@ -20,11 +24,95 @@ int main(int argc, char **argv) {
 
   if (!std::filesystem::exists(CommonPathPrefix))
     std::filesystem::create_directory(CommonPathPrefix);
-  
-  index_manager.Init();
+
+  // options come before the other arguments
+  constexpr std::string_view kBufferBlocks = "--buffer-blocks=",
+                             kReadAhead = "--read-ahead=",
+                             kDirtyLow = "--dirty-low=",
+                             kDirtyHigh = "--dirty-high=",
+                             kSyncCommit = "--sync-commit=",
+                             kCheckpointInterval = "--checkpoint-interval=",
+                             kCheckpointDirty = "--checkpoint-dirty=",
+                             kReadOnly = "--read-only";  // takes no value
+  while (argc >= 2 && std::string_view(argv[1]).starts_with("--") &&
+         (std::string_view(argv[1]).find('=') != std::string_view::npos ||
+          argv[1] == kReadOnly)) {
+    const std::string_view option = argv[1];
+    try {
+      if (option == kReadOnly) {
+        if (!BufferManager::ReadOnly())
+          throw std::logic_error(string("already opened for writing, set ") +
+                                 Config::kReadOnlyEnv + "=1 instead");
+      } else if (option.starts_with(kBufferBlocks))
+        BufferManager::SetBlockNum(std::stoull(argv[1] + kBufferBlocks.size()));
+      else if (option.starts_with(kReadAhead))
+        BufferManager::SetReadAhead(std::stoull(argv[1] + kReadAhead.size()));
+      else if (option.starts_with(kDirtyLow))
+        BufferManager::SetDirtyLowPercent(
+            std::stoull(argv[1] + kDirtyLow.size()));
+      else if (option.starts_with(kDirtyHigh))
+        BufferManager::SetDirtyHighPercent(
+            std::stoull(argv[1] + kDirtyHigh.size()));
+      else if (option.starts_with(kSyncCommit))
+        BufferManager::SetSyncCommit(std::stoull(argv[1] + kSyncCommit.size()));
+      else if (option.starts_with(kCheckpointInterval))
+        BufferManager::SetCheckpointInterval(
+            std::stoull(argv[1] + kCheckpointInterval.size()));
+      else if (option.starts_with(kCheckpointDirty))
+        BufferManager::SetCheckpointDirtyPercent(
+            std::stoull(argv[1] + kCheckpointDirty.size()));
+      else
+        throw std::invalid_argument("unknown option");
+    } catch (const std::exception &e) {
+      std::cout << "invalid " << option << ": " << e.what() << std::endl;
+      return 1;
+    }
+    argv[1] = argv[0];
+    argc--, argv++;
+  }
+
+  if (argc == 2 && std::string_view(argv[1]) == "--migrate") {
+#ifndef Tablespace
+    // the block files are what this build reads, the tablespace isn't
+    std::cout << "can't migrate: built without Tablespace" << std::endl;
+    return 1;
+#else
+    // one file per block -> tablespace, should run before anything is read;
+    // the block files are only removed once the tablespace passes a scrub
+    try {
+      const auto count = MigrateBlockFiles();
+      BufferManager::Open();
+      const auto stats = BufferManager::Scrub();
+      for (const auto &block_id : stats.corrupted)
+        std::cout << "page " << block_id << " is corrupted" << std::endl;
+      if (!stats.corrupted.empty()) {
+        std::cout << "the block files are kept" << std::endl;
+        return 1;
+      }
+      FileBlockStore().Remove();
+      std::cout << count << " blocks migrated into the tablespace"
+                << std::endl;
+    } catch (const std::exception &e) {
+      std::cout << "can't migrate: " << e.what() << std::endl;
+      return 1;
+    }
+    return 0;
+#endif
+  }
+
+  if (argc == 2 && std::string_view(argv[1]) == "--scrub") {
+    // verify every page on the disk, the exit code tells whether they are fine
+    const auto stats = BufferManager::Scrub();
+    for (const auto &block_id : stats.corrupted)
+      std::cout << "page " << block_id << " is corrupted" << std::endl;
+    std::cout << stats.checked_pages << " pages checked, "
+              << stats.corrupted.size() << " corrupted" << std::endl;
+    return stats.corrupted.empty() ? 0 : 1;
+  }
 
   std::ios_base::sync_with_stdio(false);
   try {
+    index_manager.Init();  // reads the tables, which may be corrupted
     if (argc == 1) {
       interpreter.interpret();
     } else {